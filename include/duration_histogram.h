@@ -0,0 +1,98 @@
+#pragma once
+
+#include "hal.h"
+#if defined(ESP32)
+#include <hal/cpu_hal.h>
+#endif
+
+#define HISTOGRAM_BUCKETS 26 // Верхние границы 1, 2, 4 ... 2^24 мкс (16.8 с) и +Inf
+
+// Замер интервалов по счётчику тактов ядра: чтение регистра, без вызовов.
+// Начало и конец замера должны быть на одном ядре - задачи закреплены за ядрами.
+class CycleClock
+{
+public:
+  static void begin()
+  {
+#if defined(ESP32)
+    mhz = getCpuFrequencyMhz();
+#endif
+  }
+
+  static uint32_t now()
+  {
+#if defined(ESP32)
+    return cpu_hal_get_cycle_count();
+#else
+    return hal::micros();
+#endif
+  }
+
+  // Не длиннее 2^32 тактов: 17.9 с на 240 МГц
+  static uint32_t to_us(uint32_t cycles) { return cycles / mhz; }
+  static uint32_t elapsed_us(uint32_t since) { return to_us(now() - since); }
+
+private:
+  static inline uint32_t mhz = 1; // Без begin() на ESP32 - такты вместо микросекунд
+};
+
+// Гистограмма длительностей с границами по степеням двойки: добавление -
+// счёт ведущих нулей и три сложения. Пишет одна задача; читатель из другой
+// может получить слегка несогласованный снимок, как у HeapMonitor.
+class DurationHistogram
+{
+public:
+  void add_us(uint32_t us)
+  {
+    uint8_t bucket = us <= 1 ? 0 : 32 - __builtin_clz(us - 1); // ceil(log2(us))
+    if (bucket >= HISTOGRAM_BUCKETS)
+      bucket = HISTOGRAM_BUCKETS - 1;
+    buckets[bucket]++;
+    sum_us += us;
+    samples++;
+    if (us > max_us)
+      max_us = us;
+  }
+
+  uint32_t count() const { return samples; }
+  uint32_t max() const { return max_us; }
+  uint32_t bucket(uint8_t i) const { return buckets[i]; }
+
+  // Граница корзины в мкс; у последней - бесконечность
+  static uint32_t bucket_limit_us(uint8_t i) { return 1UL << i; }
+
+  uint64_t sum() const
+  {
+    // 64-битная сумма меняется не атомарно: перечитываем до совпадения
+    uint64_t first, second;
+    do
+    {
+      first = sum_us;
+      second = sum_us;
+    } while (first != second);
+    return first;
+  }
+
+  // Оценка квантиля сверху - граница корзины, в которой он лежит
+  uint32_t quantile_us(float fraction) const
+  {
+    uint32_t total = samples;
+    if (total == 0)
+      return 0;
+    uint32_t rank = (uint32_t)(fraction * total);
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+    {
+      seen += buckets[i];
+      if (seen > rank)
+        return bucket_limit_us(i) < max_us ? bucket_limit_us(i) : max_us;
+    }
+    return max_us;
+  }
+
+private:
+  volatile uint32_t buckets[HISTOGRAM_BUCKETS] = {};
+  volatile uint64_t sum_us = 0;
+  volatile uint32_t samples = 0;
+  volatile uint32_t max_us = 0;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "hal.h"
+#include "step_generator.h"
+
+// Срабатывание концевика, зафиксированное на фронте
+struct EndstopEvent
+{
+  int64_t steps;    // Позиция генератора шагов в момент фронта
+  uint32_t time_us; // Время фронта по hal::micros()
+};
+
+// Концевик на прерывании GPIO. Фронт срабатывания сразу фиксирует позицию в шагах
+// и время, а во взведённом режиме останавливает генератор прямо в обработчике,
+// не дожидаясь очередного прохода update(). Антидребезг - окно блокировки после
+// принятого фронта; по его окончании pressed() сверяет состояние с уровнем пина.
+template <uint8_t Pin, bool ActiveLevel>
+class Endstop
+{
+public:
+  Endstop(StepGenerator &generator, uint32_t debounce_us) : generator(generator),
+                                                            debounce_us(debounce_us)
+  {
+  }
+
+  void begin()
+  {
+    hal::pin_input_pullup(Pin);
+    stable_pressed = read_level();
+    last_edge_us = hal::micros();
+    hal::attach_change_interrupt(Pin, on_edge, this);
+  }
+
+  // Взвести захват следующего срабатывания; halt - остановить генератор на фронте.
+  // Если концевик уже нажат, срабатывание фиксируется сразу.
+  void arm(bool halt)
+  {
+    portENTER_CRITICAL(&mux);
+    triggered = false;
+    halt_on_trigger = halt;
+    armed = true;
+    if (stable_pressed)
+      capture(hal::micros());
+    portEXIT_CRITICAL(&mux);
+  }
+
+  void disarm() { armed = false; }
+
+  bool take_trigger(EndstopEvent &out)
+  {
+    if (!triggered)
+      return false;
+    portENTER_CRITICAL(&mux);
+    out = event;
+    triggered = false;
+    portEXIT_CRITICAL(&mux);
+    return true;
+  }
+
+  bool pressed()
+  {
+    uint32_t now = hal::micros();
+    if (now - last_edge_us > debounce_us && read_level() != stable_pressed)
+    {
+      // Фронт пришёлся на окно антидребезга - принимаем установившийся уровень
+      portENTER_CRITICAL(&mux);
+      bool was_armed = armed;
+      accept(!stable_pressed, now);
+      bool halt = stable_pressed && was_armed && halt_on_trigger;
+      portEXIT_CRITICAL(&mux);
+      if (halt)
+        generator.stop();
+    }
+    return stable_pressed;
+  }
+
+  static bool read_level() { return hal::read<Pin>() == ActiveLevel; }
+
+private:
+  StepGenerator &generator;
+  const uint32_t debounce_us;
+
+  volatile bool stable_pressed = false;
+  volatile bool armed = false;
+  volatile bool halt_on_trigger = false;
+  volatile bool triggered = false;
+  volatile uint32_t last_edge_us = 0;
+  EndstopEvent event = {0, 0};
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+  void capture(uint32_t now)
+  {
+    event.steps = generator.current_position();
+    event.time_us = now;
+    triggered = true;
+    armed = false;
+  }
+
+  void accept(bool active, uint32_t now)
+  {
+    stable_pressed = active;
+    last_edge_us = now;
+    if (active && armed)
+      capture(now);
+  }
+
+  static void IRAM_ATTR on_edge(void *arg)
+  {
+    Endstop *self = static_cast<Endstop *>(arg);
+    uint32_t now = hal::micros();
+    if (now - self->last_edge_us < self->debounce_us)
+      return; // Дребезг после принятого фронта
+    bool active = read_level();
+    if (active == self->stable_pressed)
+      return;
+    portENTER_CRITICAL_ISR(&self->mux);
+    bool was_armed = self->armed;
+    if (active && was_armed && self->halt_on_trigger)
+      self->generator.halt_from_isr(); // Сначала остановка, затем фиксация позиции
+    self->accept(active, now);
+    portEXIT_CRITICAL_ISR(&self->mux);
+  }
+};
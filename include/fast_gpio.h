@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Arduino.h>
+
+#if defined(ESP32)
+#include <soc/gpio_struct.h>
+#endif
+
+// Запись и чтение пина, номер которого известен при компиляции. На ESP32 маска и
+// банк регистров сворачиваются в константу: одна запись в GPIO.out_w1ts/out_w1tc.
+// Принудительное встраивание: функции вызываются из обработчиков прерываний в IRAM.
+template <uint8_t Pin>
+inline __attribute__((always_inline)) void fast_write(bool high)
+{
+#if defined(ESP32)
+  constexpr uint32_t mask = 1u << (Pin & 31);
+  if (Pin < 32)
+  {
+    if (high)
+      GPIO.out_w1ts = mask;
+    else
+      GPIO.out_w1tc = mask;
+  }
+  else
+  {
+    if (high)
+      GPIO.out1_w1ts.val = mask;
+    else
+      GPIO.out1_w1tc.val = mask;
+  }
+#else
+  digitalWrite(Pin, high ? HIGH : LOW);
+#endif
+}
+
+template <uint8_t Pin>
+inline __attribute__((always_inline)) bool fast_read()
+{
+#if defined(ESP32)
+  return Pin < 32 ? (GPIO.in >> (Pin & 31)) & 1 : (GPIO.in1.val >> (Pin & 31)) & 1;
+#else
+  return digitalRead(Pin) == HIGH;
+#endif
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+// Граница между логикой рельса и платформой: время, GPIO и прерывание пина.
+// Шаги - за интерфейсом StepGenerator, HTTP - за HttpRequest. На плате это
+// тонкие встраиваемые обёртки над Arduino и регистрами GPIO (пины известны
+// при компиляции, поэтому без виртуальных вызовов в обработчиках прерываний);
+// в сборке native - симуляция из hal_sim.h с виртуальным временем.
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+
+#include "fast_gpio.h"
+
+namespace hal
+{
+  inline uint32_t millis() { return ::millis(); }
+  inline uint32_t micros() { return ::micros(); }
+  inline void delay_ms(uint32_t ms) { ::delay(ms); }
+  inline void delay_us(uint32_t us) { ::delayMicroseconds(us); }
+
+  inline void pin_output(uint8_t pin) { pinMode(pin, OUTPUT); }
+  inline void pin_input_pullup(uint8_t pin) { pinMode(pin, INPUT_PULLUP); }
+
+  template <uint8_t Pin>
+  inline __attribute__((always_inline)) void write(bool high) { fast_write<Pin>(high); }
+
+  template <uint8_t Pin>
+  inline __attribute__((always_inline)) bool read() { return fast_read<Pin>(); }
+
+  // Обработчик вызывается из прерывания на любом изменении уровня
+  inline void attach_change_interrupt(uint8_t pin, void (*handler)(void *), void *arg)
+  {
+    attachInterruptArg(digitalPinToInterrupt(pin), handler, arg, CHANGE);
+  }
+}
+
+#else
+
+#include "hal_sim.h"
+
+#endif
@@ -0,0 +1,154 @@
+#pragma once
+
+#if !defined(ARDUINO)
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIM_PINS 40 // GPIO0..39, как у ESP32
+
+// Симуляция однопоточная: «прерывания» вызываются синхронно из кода,
+// изменившего уровень, поэтому критические секции FreeRTOS - пустые
+#define IRAM_ATTR
+typedef struct
+{
+  int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define portENTER_CRITICAL_SAFE(mux) ((void)(mux))
+#define portEXIT_CRITICAL_SAFE(mux) ((void)(mux))
+
+// Платформа сборки native: виртуальное время в микросекундах, уровни пинов и
+// обработчики изменения уровня. Время идёт только вперёд по set_time() и
+// задержкам кода рельса, поэтому прогон детерминирован и не ждёт реального
+// времени: минута работы рельса проходит за миллисекунды.
+class SimPlatform
+{
+public:
+  typedef void (*PinHandler)(void *arg);
+  typedef void (*OutputWatcher)(void *arg, uint8_t pin, bool high);
+
+  uint64_t now_us() const { return time_us; }
+  void set_time(uint64_t us)
+  {
+    if (us > time_us)
+      time_us = us;
+  }
+  void advance_us(uint64_t us) { time_us += us; }
+
+  // Уровень входа задаёт модель механики; обработчик вызывается сразу, как прерывание
+  void set_input(uint8_t pin, bool high)
+  {
+    if (pin >= SIM_PINS)
+      return;
+    driven[pin] = true;
+    if (levels[pin] == high)
+      return;
+    levels[pin] = high;
+    if (handlers[pin])
+      handlers[pin](handler_args[pin]);
+  }
+
+  void write(uint8_t pin, bool high)
+  {
+    if (pin >= SIM_PINS || levels[pin] == high)
+      return;
+    levels[pin] = high;
+    if (watcher)
+      watcher(watcher_arg, pin, high);
+  }
+
+  // Подтяжка задаёт уровень, только пока вход не задан моделью
+  void pull_up(uint8_t pin)
+  {
+    if (pin < SIM_PINS && !driven[pin])
+      levels[pin] = true;
+  }
+
+  bool level(uint8_t pin) const { return pin < SIM_PINS && levels[pin]; }
+
+  void attach(uint8_t pin, PinHandler handler, void *arg)
+  {
+    if (pin >= SIM_PINS)
+      return;
+    handlers[pin] = handler;
+    handler_args[pin] = arg;
+  }
+
+  // Наблюдение за выходами (затвор, фокус) из теста или симулятора
+  void watch_outputs(OutputWatcher callback, void *arg)
+  {
+    watcher = callback;
+    watcher_arg = arg;
+  }
+
+  // Новый прогон с нуля: время, уровни и обработчики
+  void reset() { *this = SimPlatform(); }
+
+  bool log_enabled = true;
+
+private:
+  uint64_t time_us = 0;
+  bool levels[SIM_PINS] = {};
+  bool driven[SIM_PINS] = {};
+  PinHandler handlers[SIM_PINS] = {};
+  void *handler_args[SIM_PINS] = {};
+  OutputWatcher watcher = nullptr;
+  void *watcher_arg = nullptr;
+};
+
+// Создаётся при первом обращении: конструкторы глобальных объектов рельса уже пишут в пины
+inline SimPlatform &sim_platform()
+{
+  static SimPlatform platform;
+  return platform;
+}
+
+namespace hal
+{
+  inline uint32_t micros() { return (uint32_t)sim_platform().now_us(); }
+  inline uint32_t millis() { return (uint32_t)(sim_platform().now_us() / 1000); }
+  inline void delay_ms(uint32_t ms) { sim_platform().advance_us(ms * 1000ULL); }
+  inline void delay_us(uint32_t us) { sim_platform().advance_us(us); }
+
+  inline void pin_output(uint8_t) {}
+  inline void pin_input_pullup(uint8_t pin) { sim_platform().pull_up(pin); }
+
+  template <uint8_t Pin>
+  inline void write(bool high) { sim_platform().write(Pin, high); }
+
+  template <uint8_t Pin>
+  inline bool read() { return sim_platform().level(Pin); }
+
+  inline void attach_change_interrupt(uint8_t pin, void (*handler)(void *), void *arg)
+  {
+    sim_platform().attach(pin, handler, arg);
+  }
+
+  // Журнал сборки native: сразу в stdout, с виртуальным временем
+  __attribute__((format(printf, 2, 3))) inline void log(uint8_t level, const char *format, ...)
+  {
+    if (!sim_platform().log_enabled)
+      return;
+    static const char level_tags[] = "-EWID";
+    char text[160];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    size_t length = strlen(text);
+    if (length && text[length - 1] == '\n')
+      text[length - 1] = 0;
+    uint64_t now = sim_platform().now_us();
+    printf("%llu.%03llu %c %s\n", (unsigned long long)(now / 1000000), (unsigned long long)(now / 1000 % 1000),
+           level_tags[level <= 4 ? level : 0], text);
+  }
+}
+
+#endif
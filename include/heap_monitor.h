@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#if defined(ESP32)
+#include <esp_heap_caps.h>
+#endif
+
+// Состояние кучи: минимум свободной памяти с момента загрузки (пик
+// использования) и фрагментация - доля свободной памяти вне наибольшего блока.
+// Минимальный наибольший блок и максимальная фрагментация накапливаются по
+// периодическим замерам sample(), поэтому деградация аллокатора за дни работы
+// видна, даже если сейчас память уже освободилась.
+struct HeapReport
+{
+  uint32_t total;
+  uint32_t free;
+  uint32_t min_free;
+  uint32_t largest_block;
+  uint32_t min_largest_block;
+  uint8_t fragmentation_pct;
+  uint8_t max_fragmentation_pct;
+  uint32_t samples;
+};
+
+class HeapMonitor
+{
+public:
+  // Вызывается из одной задачи; читатели могут получить слегка устаревший отчёт
+  void sample()
+  {
+    HeapReport now = read();
+    if (samples == 0 || now.largest_block < min_largest_block)
+      min_largest_block = now.largest_block;
+    if (now.fragmentation_pct > max_fragmentation_pct)
+      max_fragmentation_pct = now.fragmentation_pct;
+    samples++;
+  }
+
+  HeapReport report() const
+  {
+    HeapReport now = read();
+    now.min_largest_block = samples ? min_largest_block : now.largest_block;
+    if (now.min_largest_block > now.largest_block)
+      now.min_largest_block = now.largest_block;
+    now.max_fragmentation_pct = max_fragmentation_pct > now.fragmentation_pct ? max_fragmentation_pct : now.fragmentation_pct;
+    now.samples = samples;
+    return now;
+  }
+
+private:
+  uint32_t min_largest_block = 0;
+  uint8_t max_fragmentation_pct = 0;
+  uint32_t samples = 0;
+
+  static HeapReport read()
+  {
+    HeapReport now = {};
+#if defined(ESP32)
+    now.total = heap_caps_get_total_size(MALLOC_CAP_8BIT);
+    now.free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    now.min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    now.largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#endif
+    now.fragmentation_pct = now.free ? 100 - (uint64_t)now.largest_block * 100 / now.free : 0;
+    return now;
+  }
+};
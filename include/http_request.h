@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HTTP_ARG_MAX 32 // Длина значения параметра, включая завершающий ноль
+
+// Запрос HTTP, не зависящий от сервера: обработчики API одинаково работают
+// поверх синхронного WebServer и событийного esp_http_server. Параметры и
+// заголовки копируются в буфер вызывающего, без String и без кучи.
+class HttpRequest
+{
+public:
+  virtual ~HttpRequest() {}
+
+  // false - параметра нет или значение не помещается в буфер
+  virtual bool arg(const char *name, char *value, size_t size) = 0;
+  virtual bool header(const char *name, char *value, size_t size) = 0;
+
+  // Тело запроса POST с завершающим нулём; -1 - тела нет или оно не помещается в буфер
+  virtual int body(char *buffer, size_t size) = 0;
+
+  // Значение заголовка должно жить до отправки ответа: передаются литералы и константы
+  virtual void send_header(const char *name, const char *value) = 0;
+  virtual void send(int code, const char *content_type, const char *content, size_t length) = 0;
+
+  // Ответ частями неизвестной заранее длины (chunked): большие данные без буфера
+  // на весь ответ. false из send_chunk - клиент отключился, дальше слать нечего.
+  virtual void begin_stream(int code, const char *content_type) = 0;
+  virtual bool send_chunk(const char *data, size_t length) = 0;
+  virtual void end_stream() = 0;
+
+  void send(int code, const char *content_type, const char *content)
+  {
+    send(code, content_type, content, strlen(content));
+  }
+
+  bool has_arg(const char *name)
+  {
+    char value[HTTP_ARG_MAX];
+    return arg(name, value, sizeof(value));
+  }
+
+  // Числа разбираются целиком: "12abc" считается ошибкой, а не 12
+  bool arg_int(const char *name, long &out)
+  {
+    char value[HTTP_ARG_MAX];
+    char *end;
+    if (!arg(name, value, sizeof(value)))
+      return false;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != 0)
+      return false;
+    out = parsed;
+    return true;
+  }
+
+  bool arg_float(const char *name, float &out)
+  {
+    char value[HTTP_ARG_MAX];
+    char *end;
+    if (!arg(name, value, sizeof(value)))
+      return false;
+    float parsed = strtof(value, &end);
+    if (end == value || *end != 0)
+      return false;
+    out = parsed;
+    return true;
+  }
+
+  bool arg_equals(const char *name, const char *expected)
+  {
+    char value[HTTP_ARG_MAX];
+    return arg(name, value, sizeof(value)) && strcmp(value, expected) == 0;
+  }
+
+  bool header_equals(const char *name, const char *expected)
+  {
+    char value[64];
+    return header(name, value, sizeof(value)) && strcmp(value, expected) == 0;
+  }
+};
+
+typedef void (*HttpHandler)(HttpRequest &request);
+
+struct HttpRoute
+{
+  const char *uri;
+  HttpHandler handler;
+  bool post = false; // Маршрут принимает POST с телом вместо GET
+};
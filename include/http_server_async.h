@@ -0,0 +1,64 @@
+#pragma once
+
+#if defined(ESP32)
+
+#include <atomic>
+#include <esp_http_server.h>
+
+#include "duration_histogram.h"
+#include "http_request.h"
+
+#define HTTP_WS_CLIENTS_MAX 4
+#define HTTP_WS_FRAME_MAX 256
+#define HTTP_WS_SEND_TIMEOUT_MS 20 // Отправка кадра клиенту WebSocket, дальше клиент отключается
+
+// Событийный сервер на esp_http_server из ESP-IDF: одна задача обслуживает все
+// сокеты через select(), соединения HTTP/1.1 остаются открытыми между запросами.
+// Задача сервера закрепляется на ядре сети и заменяет опрос WebServer.
+class AsyncHttpServer
+{
+public:
+  AsyncHttpServer(uint16_t port, uint8_t core, uint8_t priority, uint16_t max_clients)
+      : port(port), core(core), priority(priority), max_clients(max_clients)
+  {
+  }
+
+  bool begin(const HttpRoute *routes, size_t count);
+
+  // Канал WebSocket для рассылки с сервера; false - сборка ESP-IDF без WebSocket
+  bool add_websocket(const char *uri);
+
+  // Рассылка текста всем клиентам WebSocket из любой задачи. Пока предыдущий
+  // кадр не ушёл, новый не ставится в очередь и возвращается false: вызывающий
+  // повторит позже уже с более свежими данными. Клиент, чей буфер отправки
+  // полон, отключается, а не задерживает остальных.
+  bool broadcast(const char *text, size_t length);
+
+  // Подключились ли клиенты с прошлого вызова: им нужен полный снимок, а не разница
+  bool take_new_clients() { return new_clients.exchange(false); }
+
+  // Время обработчиков маршрутов, по запросу
+  const DurationHistogram &handler_time() const { return handler_histogram; }
+
+private:
+  const uint16_t port;
+  const uint8_t core;
+  const uint8_t priority;
+  const uint16_t max_clients;
+  httpd_handle_t handle = nullptr;
+
+  // Списки клиентов меняются только в задаче сервера
+  int ws_clients[HTTP_WS_CLIENTS_MAX];
+  uint8_t ws_count = 0;
+  std::atomic<bool> new_clients{false};
+  std::atomic<bool> frame_pending{false};
+  char frame[HTTP_WS_FRAME_MAX];
+  size_t frame_length = 0;
+  DurationHistogram handler_histogram; // Пишет только задача сервера
+
+  static esp_err_t dispatch(httpd_req_t *req);
+  static esp_err_t on_websocket(httpd_req_t *req);
+  static void send_frame(void *arg);
+};
+
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <WebServer.h>
+
+#include "duration_histogram.h"
+#include "http_request.h"
+
+// Резервный сервер на синхронном WebServer: один клиент за раз, соединение
+// закрывается после ответа, обслуживание - опросом poll() из задачи сети
+class SyncHttpServer
+{
+public:
+  explicit SyncHttpServer(uint16_t port) : server(port) {}
+
+  void begin(const HttpRoute *routes, size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      HttpHandler handler = routes[i].handler;
+      server.on(routes[i].uri, routes[i].post ? HTTP_POST : HTTP_ANY, [this, handler]()
+                {
+                  Request request(server);
+                  handler(request); });
+    }
+    const char *headers[] = {"If-None-Match"}; // WebServer хранит только перечисленные заголовки
+    server.collectHeaders(headers, 1);
+    server.begin();
+  }
+
+  void poll()
+  {
+    uint32_t start = CycleClock::now();
+    server.handleClient();
+    handler_histogram.add_us(CycleClock::elapsed_us(start));
+  }
+
+  // Время handleClient() за вызов: чтение, разбор и обработчик, либо пустой опрос
+  const DurationHistogram &handler_time() const { return handler_histogram; }
+
+private:
+  WebServer server;
+  DurationHistogram handler_histogram;
+
+  class Request : public HttpRequest
+  {
+  public:
+    explicit Request(WebServer &server) : server(server) {}
+
+    // WebServer сам хранит параметры в String - без кучи работает только событийный сервер
+    bool arg(const char *name, char *value, size_t size) override
+    {
+      return server.hasArg(name) && copy(server.arg(name), value, size);
+    }
+
+    bool header(const char *name, char *value, size_t size) override
+    {
+      return server.hasHeader(name) && copy(server.header(name), value, size);
+    }
+
+    // Тело без формы WebServer кладёт в аргумент "plain" как строку, поэтому
+    // двоичное тело с нулевыми байтами обрезается - его принимает только событийный сервер
+    int body(char *buffer, size_t size) override
+    {
+      if (!server.hasArg("plain") || !copy(server.arg("plain"), buffer, size))
+        return -1;
+      return server.arg("plain").length();
+    }
+
+    void send_header(const char *name, const char *value) override { server.sendHeader(name, value); }
+
+    void send(int code, const char *content_type, const char *content, size_t length) override
+    {
+      server.send_P(code, content_type, content, length);
+    }
+
+    void begin_stream(int code, const char *content_type) override
+    {
+      server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+      server.send(code, content_type, "");
+    }
+
+    bool send_chunk(const char *data, size_t length) override
+    {
+      server.sendContent(data, length);
+      return server.client().connected();
+    }
+
+    void end_stream() override { server.sendContent(""); } // Пустой кусок завершает chunked-ответ
+
+  private:
+    WebServer &server;
+
+    static bool copy(const String &text, char *value, size_t size)
+    {
+      if (text.length() >= size)
+        return false;
+      memcpy(value, text.c_str(), text.length() + 1);
+      return true;
+    }
+  };
+};
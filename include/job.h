@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOB_MAX_SEGMENTS 8   // Участков с разным шагом и скоростью в одном задании
+#define JOB_MAX_FRAMES 10000 // Кадров в задании
+#define JOB_MAX_DELAY_MS 60000
+#define JOB_BODY_MAX 1024    // Тело запроса /job; JSON на 8 участков - около 600 байт
+#define JOB_QUEUE_SIZE 8     // Заданий в очереди вместе с текущим и последними завершёнными
+
+// Действие после последнего кадра задания
+enum JobAfter : uint8_t
+{
+  JOB_AFTER_STAY,   // Остаться на последнем кадре
+  JOB_AFTER_RETURN, // Вернуться к началу стека
+  JOB_AFTER_PARK,   // Уехать в точку парковки
+  JOB_AFTER_HOME    // Выполнить хоуминг
+};
+
+// Участок стека: кадры с одинаковым шагом и скоростью подвода.
+// Первый кадр следующего участка - на его шаг дальше последнего кадра предыдущего.
+struct JobSegment
+{
+  int32_t step_um; // Знак - направление
+  uint16_t frames;
+  float speed;     // мм/с
+};
+
+// Задание стека в единицах клиента (мкм, мс), уже без сокращений: кадры
+// каждого участка посчитаны. Перевод в шаги и проверка по ходу рельса -
+// в MacroRail::plan_job(), где известна механика.
+struct JobSpec
+{
+  bool home = false; // Хоуминг перед стеком
+  bool preposition = false; // Предыдущее задание вместо своего действия после стека едет к началу этого
+  bool has_start = false; // Без начала стек снимается от текущей позиции
+  int32_t start_um = 0;
+  uint8_t segment_count = 0;
+  JobSegment segments[JOB_MAX_SEGMENTS];
+  int32_t focus_time = 500;
+  int32_t release_time = 200;
+  int32_t before_shoot_delay = 100;
+  int32_t after_shoot_delay = 100;
+  bool s_curve = true;
+  bool continuous = false;
+  JobAfter after = JOB_AFTER_STAY;
+  int32_t park_um = 0;
+};
+
+// Разбор тела /job. Поля, которых нет в запросе, остаются как в job: вызывающий
+// заполняет его текущими настройками, а segments[0] служит умолчанием для
+// сокращённой записи с одним участком. Тело JSON должно заканчиваться нулём;
+// error - литерал с причиной отказа.
+//
+// JSON:
+//   {"home": true, "start_mm": 10.5,
+//    "step_um": 50, "frames": 40, "end_mm": 12.5, "speed": 0.7,  - один участок
+//    "segments": [{"step_um": 50, "frames": 20, "speed": 0.5},     - или несколько;
+//                 {"step_um": 100, "end_mm": 14}],                   пропуски - с верхнего уровня
+//    "camera": {"focus_ms": 500, "release_ms": 200, "before_ms": 100, "after_ms": 100},
+//    "mode": "stepped" | "flyby", "s_curve": true,
+//    "then": "stay" | "return" | "park" | "home", "park_mm": 0, "preposition": false}
+// У участка задаются любые два из step_um, frames, end_mm; end_mm требует start_mm.
+//
+// Двоичная форма, little-endian, версия 1 (первый байт отличает её от JSON):
+//   0  u8   версия = 1
+//   1  u8   флаги: 0 - home, 1 - есть начало, 2 - на ходу, 3 - S-кривая, 4 - предподвод
+//   2  u8   действие после стека (JobAfter)
+//   3  u8   число участков
+//   4  i32  начало, мкм
+//   8  i32  парковка, мкм
+//   12 u16  focus, release, before, after - мс
+//   20      участки по 8 байт: i32 шаг мкм, u16 кадры, u16 скорость мкм/с
+bool parse_job(const char *body, size_t length, JobSpec &job, const char *&error);
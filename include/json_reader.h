@@ -0,0 +1,158 @@
+#pragma once
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Потоковое чтение JSON из буфера вызывающего, без кучи и без дерева: вызывающий
+// сам обходит объекты и массивы в нужном ему порядке и знает тип каждого
+// значения - незнакомый ключ для него ошибка. Текст должен заканчиваться нулём.
+// После первой ошибки все вызовы возвращают false, а ok() - false; конец объекта
+// или массива отличается от ошибки только по ok().
+class JsonReader
+{
+public:
+  explicit JsonReader(const char *text) : cursor(text) {}
+
+  bool begin_object() { return open('{'); }
+  bool begin_array() { return open('['); }
+
+  // Следующий ключ объекта вместе с ':'; false - объект закончился
+  bool next_key(char *key, size_t size)
+  {
+    return next_member('}') && read_string(key, size) && expect(':');
+  }
+
+  // Есть ли следующий элемент массива; false - массив закончился
+  bool next_item() { return next_member(']'); }
+
+  bool read_number(float &value)
+  {
+    const char *start = skip_space();
+    if (failed || !(*start == '-' || isdigit((unsigned char)*start))) // strtof принял бы и "inf", и "0x1p3"
+      return fail();
+    char *end;
+    value = strtof(start, &end);
+    cursor = end;
+    return true;
+  }
+
+  bool read_int(long &value)
+  {
+    float number;
+    if (!read_number(number))
+      return false;
+    value = lroundf(number);
+    if (number != value)
+      return fail(); // Дробное значение там, где ждём целое
+    return true;
+  }
+
+  bool read_bool(bool &value)
+  {
+    if (literal("true"))
+      value = true;
+    else if (literal("false"))
+      value = false;
+    else
+      return fail();
+    return true;
+  }
+
+  // Поддерживаются только простые экранирования; \uXXXX - ошибка
+  bool read_string(char *value, size_t size)
+  {
+    if (!expect('"'))
+      return false;
+    size_t used = 0;
+    while (*cursor != '"')
+    {
+      char c = *cursor++;
+      if (c == 0 || used + 1 >= size)
+        return fail();
+      if (c == '\\')
+      {
+        c = *cursor++;
+        if (c == 'n')
+          c = '\n';
+        else if (c == 't')
+          c = '\t';
+        else if (c != '"' && c != '\\' && c != '/')
+          return fail();
+      }
+      value[used++] = c;
+    }
+    cursor++;
+    value[used] = 0;
+    return true;
+  }
+
+  // Весь текст разобран и после значения нет мусора
+  bool finished() { return !failed && *skip_space() == 0; }
+
+  bool ok() const { return !failed; }
+
+private:
+  const char *cursor;
+  bool failed = false;
+  bool first = false; // Следующий член контейнера - первый, запятая перед ним не нужна
+
+  bool fail()
+  {
+    failed = true;
+    return false;
+  }
+
+  const char *skip_space()
+  {
+    while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')
+      cursor++;
+    return cursor;
+  }
+
+  bool expect(char c)
+  {
+    if (failed || *skip_space() != c)
+      return fail();
+    cursor++;
+    return true;
+  }
+
+  bool literal(const char *word)
+  {
+    const char *start = skip_space();
+    size_t i = 0;
+    for (; word[i]; i++)
+      if (start[i] != word[i])
+        return false;
+    cursor = start + i;
+    return true;
+  }
+
+  bool open(char bracket)
+  {
+    if (!expect(bracket))
+      return false;
+    first = true;
+    return true;
+  }
+
+  // Закрытый вложенный контейнер - уже член родителя, поэтому после него
+  // у родителя first всегда сброшен и одного флага на все уровни достаточно
+  bool next_member(char close)
+  {
+    if (failed)
+      return false;
+    if (*skip_space() == close)
+    {
+      cursor++;
+      first = false;
+      return false;
+    }
+    if (!first && !expect(','))
+      return false;
+    first = false;
+    return true;
+  }
+};
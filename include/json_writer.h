@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Запись JSON в буфер вызывающего, без кучи. Ключи и строковые значения -
+// константы прошивки, поэтому экранирование не выполняется. При переполнении
+// запись прекращается, а ok() возвращает false.
+class JsonWriter
+{
+public:
+  JsonWriter(char *buffer, size_t size) : buffer(buffer), size(size)
+  {
+    buffer[0] = 0;
+  }
+
+  JsonWriter &begin_object(const char *key = nullptr)
+  {
+    write_key(key);
+    append("{");
+    need_comma = false;
+    return *this;
+  }
+
+  JsonWriter &end_object()
+  {
+    append("}");
+    need_comma = true;
+    return *this;
+  }
+
+  // Элементы массива - объекты без ключа: begin_object()
+  JsonWriter &begin_array(const char *key)
+  {
+    write_key(key);
+    append("[");
+    need_comma = false;
+    return *this;
+  }
+
+  JsonWriter &end_array()
+  {
+    append("]");
+    need_comma = true;
+    return *this;
+  }
+
+  // Перегрузки по базовым типам: int32_t/int64_t на разных платформах - разные из них
+  JsonWriter &field(const char *key, int value) { return value_field(key, "%d", value); }
+  JsonWriter &field(const char *key, unsigned value) { return value_field(key, "%u", value); }
+  JsonWriter &field(const char *key, long value) { return value_field(key, "%ld", value); }
+  JsonWriter &field(const char *key, unsigned long value) { return value_field(key, "%lu", value); }
+  JsonWriter &field(const char *key, long long value) { return value_field(key, "%lld", value); }
+  JsonWriter &field(const char *key, bool value) { return value_field(key, "%s", value ? "true" : "false"); }
+  JsonWriter &field(const char *key, const char *value) { return value_field(key, "\"%s\"", value); }
+  JsonWriter &field(const char *key, float value, int decimals = 3) { return value_field(key, "%.*f", decimals, (double)value); }
+
+  bool ok() const { return !overflow; }
+  size_t length() const { return used; }
+  const char *c_str() const { return buffer; }
+
+private:
+  char *buffer;
+  size_t size;
+  size_t used = 0;
+  bool need_comma = false;
+  bool overflow = false;
+
+  void write_key(const char *key)
+  {
+    if (need_comma)
+      append(",");
+    if (key)
+      append("\"%s\":", key);
+  }
+
+  JsonWriter &value_field(const char *key, const char *format, ...)
+  {
+    write_key(key);
+    va_list args;
+    va_start(args, format);
+    vappend(format, args);
+    va_end(args);
+    need_comma = true;
+    return *this;
+  }
+
+  void append(const char *format, ...)
+  {
+    va_list args;
+    va_start(args, format);
+    vappend(format, args);
+    va_end(args);
+  }
+
+  void vappend(const char *format, va_list args)
+  {
+    if (overflow)
+      return;
+    int written = vsnprintf(buffer + used, size - used, format, args);
+    if (written < 0 || (size_t)written >= size - used)
+    {
+      overflow = true;
+      buffer[used] = 0; // Обрезанный хвост не выдаётся
+      return;
+    }
+    used += written;
+  }
+};
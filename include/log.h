@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+
+#include "hal.h"
+
+#define RAIL_LOG_NONE 0
+#define RAIL_LOG_ERROR 1
+#define RAIL_LOG_WARN 2
+#define RAIL_LOG_INFO 3
+#define RAIL_LOG_DEBUG 4
+
+// Вызовы подробнее этого уровня вырезаются при компиляции вместе с вычислением аргументов
+#ifndef RAIL_LOG_LEVEL
+#define RAIL_LOG_LEVEL RAIL_LOG_INFO
+#endif
+
+#define LOG_SLOTS 64     // Записей в очереди, степень двойки
+#define LOG_LINE_MAX 96  // Запись с завершающим нулём; длиннее - обрезается
+#define LOG_HISTORY 4096 // Хвост журнала для /log
+
+// На плате - в журнал ниже, в сборке native - сразу в stdout
+#if defined(ARDUINO)
+#define RAIL_LOG_WRITE(level, ...) rail_log.write(level, __VA_ARGS__)
+#else
+#define RAIL_LOG_WRITE(level, ...) hal::log(level, __VA_ARGS__)
+#endif
+
+#if RAIL_LOG_LEVEL >= RAIL_LOG_ERROR
+#define LOG_ERROR(...) RAIL_LOG_WRITE(RAIL_LOG_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if RAIL_LOG_LEVEL >= RAIL_LOG_WARN
+#define LOG_WARN(...) RAIL_LOG_WRITE(RAIL_LOG_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if RAIL_LOG_LEVEL >= RAIL_LOG_INFO
+#define LOG_INFO(...) RAIL_LOG_WRITE(RAIL_LOG_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if RAIL_LOG_LEVEL >= RAIL_LOG_DEBUG
+#define LOG_DEBUG(...) RAIL_LOG_WRITE(RAIL_LOG_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if defined(ARDUINO)
+
+// Журнал без блокировок: запись форматируется в слот очереди прямо в
+// вызывающей задаче, а в Serial и в хвост для /log её переносит задача с
+// низким приоритетом. Медленный UART задерживает только её. Очередь -
+// ограниченное кольцо с номером последовательности в каждом слоте: писать
+// можно из любых задач одновременно, при переполнении запись отбрасывается
+// и учитывается в dropped(). Из прерываний не вызывается.
+//
+// Конструктора нет: нули статической памяти - рабочее начальное состояние,
+// поэтому писать можно и из конструкторов глобальных объектов других модулей,
+// до begin(). Экземпляр - только глобальный.
+class Logger
+{
+public:
+  void begin(uint8_t core, uint8_t priority);
+
+  void write(uint8_t level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+  // Хвост журнала целыми строками, от старых к новым; вызывается из задачи сервера
+  size_t copy_history(char *out, size_t size);
+
+  uint32_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+
+private:
+  struct Slot
+  {
+    std::atomic<uint32_t> sequence; // Номер записи минус номер слота: в начале - нули
+    uint32_t time_ms;
+    uint8_t level;
+    char text[LOG_LINE_MAX];
+  };
+
+  Slot slots[LOG_SLOTS];
+  std::atomic<uint32_t> head;
+  uint32_t tail; // Только задача выгрузки
+  std::atomic<uint32_t> dropped_count;
+
+  char history[LOG_HISTORY];
+  size_t history_end;
+  bool history_wrapped;
+  SemaphoreHandle_t history_lock;
+
+  static void task(void *arg);
+  bool drain_one();
+  void append_history(const char *line, size_t length);
+};
+
+extern Logger rail_log;
+
+#endif
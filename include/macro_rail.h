@@ -0,0 +1,1192 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+#include "endstop.h"
+#include "hal.h"
+#include "job.h"
+#include "log.h"
+#include "power_manager.h"
+#include "rail_config.h"
+#include "rail_types.h"
+#include "stack_simulator.h"
+#include "step_generator.h"
+#include "step_trace.h"
+
+// Контроллер рельса, специализированный конфигурацией механики и пинов при компиляции
+template <typename RailConfig>
+class MacroRail : public MacroRailBase
+{
+public:
+  typedef RailConfig Config;
+  typedef RailMechanics<Config> Mechanics;
+  typedef StackSimulator<Config> Simulator;
+
+  unsigned long homing_retract_start;
+
+  // Перевод между мкм и шагами по точной дроби без накопления ошибки округления
+  static constexpr int64_t um_to_steps(int64_t um) { return Mechanics::um_to_steps(um); }
+  static constexpr int64_t steps_to_um(int64_t steps) { return Mechanics::steps_to_um(steps); }
+
+  // Миллиметры - только на границе API
+  static float steps_to_mm(int64_t steps) { return steps_to_um(steps) / 1000.0f; }
+  static int64_t mm_to_steps(float mm) { return um_to_steps(lroundf(mm * 1000.0f)); }
+
+  float get_target_position() const
+  {
+    return steps_to_mm(stepper.target_position());
+  }
+
+  float get_current_position() const
+  {
+    return steps_to_mm(stepper.current_position());
+  }
+
+  int64_t get_current_steps() const
+  {
+    return stepper.current_position();
+  }
+
+  bool is_referenced() const
+  {
+    return referenced;
+  }
+
+  float get_steps_per_mm() const
+  {
+    return steps_per_mm();
+  }
+
+  void motor_test()
+  {
+    enable_motor();
+    stepper.move(100);
+    while (stepper.distance_to_go() != 0)
+    {
+      stepper.run();
+    }
+    disable_motor();
+  }
+
+  void enable() { enable_motor(); }
+  void disable() { disable_motor(); }
+
+  void force_enable() { enable_motor(); }
+
+  void test_direction()
+  {
+    enable_motor();
+    LOG_DEBUG("Testing direction...");
+
+    LOG_DEBUG("Moving forward 1mm...");
+    stepper.move_to(1 * steps_per_mm());
+    while (stepper.distance_to_go() != 0)
+    {
+      stepper.run();
+    }
+    hal::delay_ms(1000);
+
+    LOG_DEBUG("Moving back to 0mm...");
+    stepper.move_to(0);
+    while (stepper.distance_to_go() != 0)
+    {
+      stepper.run();
+    }
+
+    disable_motor();
+    LOG_DEBUG("Direction test completed");
+  }
+
+  MacroRail(StepGenerator &generator) : stepper(generator),
+                                        endstop(generator, Config::debounce_ms * 1000UL),
+                                        power(Config::driver_hold_ms, Config::driver_wake_us),
+                                        state(IDLE)
+  {
+    power.begin();
+
+    hal::pin_output(Config::focus_pin);
+    hal::write<Config::focus_pin>(false);
+
+    hal::pin_output(Config::shutter_pin);
+    hal::write<Config::shutter_pin>(false);
+
+    stepper.set_limits(homing_limits(Config::homing_speed));
+
+    LOG_INFO("Motor settings: %.2f steps/mm", steps_per_mm());
+  }
+
+  // Подключение прерывания концевика; вызывается после begin() генератора шагов
+  void begin()
+  {
+    endstop.begin();
+  }
+
+  bool check_endstop()
+  {
+    return endstop.pressed();
+  }
+
+  void update()
+  {
+    power.update();
+    trace_transitions(); // Команды между вызовами update() тоже меняют состояние
+
+    static int previous_state = -1;
+    static bool previous_endstop_state = false;
+    bool current_endstop_state = endstop.pressed();
+
+    if (state != previous_state || current_endstop_state != previous_endstop_state)
+    {
+      LOG_DEBUG("State: %d (%s), Endstop: %d (%s)",
+                state, get_state_string(state),
+                current_endstop_state, current_endstop_state ? "PRESSED" : "released");
+      previous_state = state;
+      previous_endstop_state = current_endstop_state;
+    }
+
+    if (state == HOMING)
+    {
+      handle_homing();
+      stepper.run();
+    }
+    else if (state == HOMING_RETRACT)
+    {
+      if (stepper.distance_to_go() == 0)
+      {
+        stepper.set_current_position(0);
+        state = IDLE;
+        referenced = true;
+        disable_motor();
+        homing_time_ms = hal::millis() - homing_start_ms;
+        LOG_INFO("=== RETRACT COMPLETE - ZERO SET in %lums ===", (unsigned long)homing_time_ms);
+        is_busy = false;
+      }
+      else if (hal::millis() - homing_retract_start > 60000)
+      {
+        LOG_ERROR("Retract timeout!");
+        stepper.stop();
+        state = ERROR;
+        power.disable();
+      }
+      stepper.run();
+    }
+    else if (state == MOVING)
+    {
+      if (stepper.distance_to_go() == 0)
+      {
+        state = IDLE;
+        disable_motor();
+        is_busy = false;
+      }
+      else
+      {
+        stepper.run();
+      }
+    }
+    else if (state == SHOOTING)
+    {
+      if (settings.continuous)
+        handle_flyby();
+      else
+        handle_shooting();
+    }
+    else if (state == ERROR)
+    {
+      handle_error();
+    }
+    else if (state == IDLE)
+    {
+      handle_idle();
+      is_busy = false;
+    }
+    else // Для всех остальных состояний (на всякий случай)
+    {
+      if (check_endstop())
+      {
+        emergency_stop("Endstop triggered");
+      }
+      stepper.run(); // Чтобы программный генератор мог обрабатывать команды
+    }
+
+    advance_job();
+    if (job_stage == JOB_NONE && state == IDLE && queue_next < queue_count)
+      start_next_job();
+    trace_transitions();
+  }
+
+  // Хоуминг по команде прерывает идущее задание, как и ручное движение
+  void start_homing()
+  {
+    interrupt_job("Interrupted by homing");
+    begin_homing();
+  }
+
+  // Быстрая перепривязка, когда позиция известна (тёплый перезапуск): ускоренный
+  // ход к точке на расстоянии отъезда от концевика и сразу медленный проход.
+  // Концевик взведён и на подходе - если позиция неверна, фронт остановит рельс,
+  // как при обычном поиске; не найденный на медленном проходе фронт переводит
+  // на полный хоуминг.
+  void start_rereference(int64_t known_steps)
+  {
+    interrupt_job("Interrupted by re-reference");
+    if (state != IDLE)
+      return;
+    LOG_INFO("=== QUICK RE-REFERENCE from %.2fmm ===", steps_to_mm(known_steps));
+    is_busy = true;
+    enable_motor();
+    stepper.set_current_position(known_steps);
+    state = HOMING;
+    referenced = false;
+    homing_phase = HOMING_APPROACH;
+    homing_quick = true;
+    homing_start_ms = hal::millis();
+    homing_start_us = hal::micros();
+    homing_start_position = known_steps;
+
+    endstop.arm(true);
+    stepper.set_limits(rapid_limits());
+    stepper.move_to(um_to_steps(Config::homing_backoff_um));
+  }
+
+  void set_settings(const Settings &new_settings)
+  {
+    settings = new_settings;
+  }
+
+  void move_to(float position)
+  {
+    interrupt_job("Interrupted by manual move");
+    move_to_steps(mm_to_steps(position));
+  }
+
+  void move_by(float offset)
+  {
+    interrupt_job("Interrupted by manual move");
+    move_to_steps(stepper.current_position() + mm_to_steps(offset));
+  }
+
+  // Проверка задания и перевод в шаги, без обращения к рельсу: вызывается из
+  // обработчика до постановки в очередь. Ход рельса проверяется, если задано
+  // начало; стек от текущей позиции, как и /start, ограничивается ходом по кадрам.
+  static bool plan_job(const JobSpec &spec, JobPlan &plan, const char *&error)
+  {
+    plan = JobPlan();
+    error = nullptr;
+    if (spec.segment_count == 0 || spec.segment_count > JOB_MAX_SEGMENTS)
+      error = "No segments";
+    else if (!delay_valid(spec.focus_time) || !delay_valid(spec.release_time) ||
+             !delay_valid(spec.before_shoot_delay) || !delay_valid(spec.after_shoot_delay))
+      error = "Camera timing out of range";
+    else if (spec.continuous && (spec.segment_count != 1 || spec.segments[0].step_um <= 0))
+      error = "Fly-by needs a single forward segment";
+    else if (spec.has_start && !in_travel(spec.start_um))
+      error = "Start outside rail travel";
+    else if (spec.after == JOB_AFTER_PARK && !in_travel(spec.park_um))
+      error = "Park position outside rail travel";
+    if (error)
+      return false;
+
+    int64_t offset_um = 0;
+    uint32_t frame = 0;
+    for (uint8_t i = 0; i < spec.segment_count; i++)
+    {
+      const JobSegment &source = spec.segments[i];
+      if (!(source.speed > 0 && source.speed <= Config::rapid_speed))
+        error = "Speed out of range";
+      else if (source.step_um == 0 && (i > 0 || source.frames > 1))
+        error = "Step must not be zero";
+      else if (source.frames < 1 || frame + source.frames > JOB_MAX_FRAMES)
+        error = "Too many frames";
+      if (error)
+        return false;
+
+      if (i > 0)
+        offset_um += source.step_um;
+      JobPlan::Segment &segment = plan.segments[i];
+      segment.offset_um = offset_um;
+      segment.step_um = source.step_um;
+      segment.first_frame = frame;
+      segment.frames = source.frames;
+      segment.speed = source.speed;
+      offset_um += (int64_t)(source.frames - 1) * source.step_um;
+      frame += source.frames;
+
+      // Внутри участка кадры монотонны - достаточно крайних
+      if (spec.has_start && !(in_travel(spec.start_um + segment.offset_um) && in_travel(spec.start_um + offset_um)))
+      {
+        error = "Stack leaves rail travel";
+        return false;
+      }
+    }
+
+    plan.segment_count = spec.segment_count;
+    plan.home = spec.home;
+    plan.preposition = spec.preposition;
+    plan.has_start = spec.has_start;
+    plan.start_steps = um_to_steps(spec.start_um);
+    plan.after = spec.after;
+    plan.park_steps = um_to_steps(spec.park_um);
+
+    Settings &settings = plan.settings;
+    settings.step_size_um = spec.segments[0].step_um;
+    settings.total_photos = frame;
+    settings.max_speed = spec.segments[0].speed;
+    settings.focus_time = spec.focus_time;
+    settings.release_time = spec.release_time;
+    settings.before_shoot_delay = spec.before_shoot_delay;
+    settings.after_shoot_delay = spec.after_shoot_delay;
+    settings.s_curve = spec.s_curve;
+    settings.continuous = spec.continuous;
+    return true;
+  }
+
+  // Постановка в очередь; задания выполняются по одному в порядке поступления.
+  // false - все слоты заняты ожидающими заданиями и текущим.
+  bool enqueue_job(uint32_t id, const JobPlan &plan)
+  {
+    if (queue_count == JOB_QUEUE_SIZE)
+    {
+      JobState oldest = queue[queue_head].record.state;
+      if (oldest == JOB_QUEUED || oldest == JOB_RUNNING)
+        return false;
+      queue_head = (queue_head + 1) % JOB_QUEUE_SIZE; // Вытесняется самая старая завершённая запись
+      queue_count--;
+      queue_next--;
+    }
+    QueueSlot &slot = queue_at(queue_count++);
+    slot.plan = plan;
+    slot.record = JobRecord();
+    slot.record.id = id;
+    slot.record.state = JOB_QUEUED;
+    slot.record.frames = plan.settings.total_photos;
+    slot.record.queued_ms = hal::millis();
+    LOG_INFO("Job %lu queued, %u pending", (unsigned long)id, (unsigned)(queue_count - queue_next));
+    return true;
+  }
+
+  // Запуск задания мимо очереди; false - рельс занят или в ошибке
+  bool start_job(const JobPlan &plan)
+  {
+    if (state != IDLE || job_stage != JOB_NONE)
+      return false;
+    job = plan;
+    settings = plan.settings;
+    job_error = nullptr;
+    photo_count = 0;
+    LOG_INFO("Job: %d frames in %u segments%s", settings.total_photos,
+             (unsigned)plan.segment_count, plan.home ? ", homing first" : "");
+    if (plan.home)
+    {
+      job_stage = JOB_HOMING;
+      begin_homing();
+    }
+    else
+    {
+      position_for_job();
+    }
+    return true;
+  }
+
+  // Стек от текущей позиции с шагом и скоростью из настроек - задание из одного
+  // участка с проверками plan_job(), как у /job; error - причина отказа
+  static bool shooting_plan(const Settings &new_settings, bool return_to_start, JobPlan &plan, const char *&error)
+  {
+    JobSpec spec;
+    spec.segment_count = 1;
+    spec.segments[0].step_um = new_settings.step_size_um;
+    spec.segments[0].frames = std::clamp(new_settings.total_photos, 1, JOB_MAX_FRAMES);
+    spec.segments[0].speed = new_settings.max_speed;
+    spec.focus_time = new_settings.focus_time;
+    spec.release_time = new_settings.release_time;
+    spec.before_shoot_delay = new_settings.before_shoot_delay;
+    spec.after_shoot_delay = new_settings.after_shoot_delay;
+    spec.s_curve = new_settings.s_curve;
+    spec.continuous = new_settings.continuous;
+    spec.after = return_to_start ? JOB_AFTER_RETURN : JOB_AFTER_STAY;
+    return plan_job(spec, plan, error);
+  }
+
+  // false - настройки не годятся для стека или рельс занят
+  bool start_shooting(const Settings &new_settings, bool return_to_start)
+  {
+    JobPlan plan;
+    const char *error;
+    if (!shooting_plan(new_settings, return_to_start, plan, error))
+    {
+      LOG_WARN("Shooting rejected: %s", error);
+      return false;
+    }
+    return start_job(plan);
+  }
+
+  void stop()
+  {
+    if (job_stage != JOB_NONE)
+      abort_job("Stopped");
+    cancel_queued("Stopped");
+    halt();
+    disable_motor();
+    is_busy = false;
+    LOG_INFO("Movement stopped");
+  }
+
+  void reset_emergency()
+  {
+    if (state == ERROR && !endstop.pressed())
+    {
+      state = IDLE;
+      is_busy = false;
+    }
+  }
+
+  // Геттеры
+  float get_position() const { return get_current_position(); }
+  State get_state() const { return state; }
+  Settings get_settings() const { return settings; }
+  int get_photo_count() const { return photo_count; }
+
+  Status get_status()
+  {
+    Status status;
+    status.state = state;
+    status.steps = stepper.current_position();
+    status.target_steps = stepper.target_position();
+    status.photo_count = photo_count;
+    status.endstop = endstop.pressed();
+    status.referenced = referenced;
+    status.homing_time_ms = homing_time_ms;
+    status.frame_error_steps = frame_error_steps;
+    status.frame_error_max_steps = frame_error_max_steps;
+    status.driver_energised = power.is_energised();
+    status.driver_energised_ms = power.energised_ms();
+    status.driver_enable_count = power.enable_count();
+    status.job_stage = job_stage;
+    status.job_error = job_error;
+    // Прогноз появляется после хоуминга задания: его длительность заранее неизвестна
+    status.job_estimate_ms = 0;
+    status.job_eta_ms = 0;
+    if (job_stage != JOB_NONE && job_stage != JOB_HOMING)
+    {
+      uint32_t elapsed = hal::millis() - estimate_start_ms;
+      status.job_estimate_ms = job_estimate.total_ms;
+      status.job_eta_ms = elapsed < job_estimate.total_ms ? job_estimate.total_ms - elapsed : 0;
+    }
+    if (running_job)
+      running_job->photos = photo_count;
+    status.job_count = queue_count;
+    for (uint8_t i = 0; i < queue_count; i++)
+      status.jobs[i] = queue_at(i).record;
+    status.settings = settings;
+    return status;
+  }
+
+private:
+  StepGenerator &stepper;
+  Endstop<Config::endstop_pin, Config::endstop_active> endstop;
+  PowerManager<Config::enable_pin, Config::enable_active> power;
+  State state;
+  Settings settings;
+  int photo_count = 0;
+
+  // Хоуминг в два прохода: быстрый поиск, отъезд, медленный повторный подход
+  enum HomingPhase : uint8_t
+  {
+    HOMING_FAST_SEEK,
+    HOMING_BACKOFF,
+    HOMING_SLOW_SEEK,
+    HOMING_APPROACH // Ускоренный подход перепривязки вместо быстрого поиска
+  };
+
+  HomingPhase homing_phase = HOMING_FAST_SEEK;
+  bool homing_quick = false; // Идёт перепривязка по известной позиции
+  bool referenced = false;
+  unsigned long homing_start_ms = 0;
+  uint32_t homing_start_us = 0;
+  uint32_t homing_time_ms = 0; // Длительность последнего хоуминга, 0 - не выполнялся
+  int64_t homing_start_position = 0;
+  bool is_busy = false;
+  int64_t start_position = 0; // В шагах
+#if STEP_TRACE
+  uint8_t traced_state = 0xff; // Последние значения, записанные в трассу шагов
+  uint8_t traced_shot_stage = 0xff;
+  uint8_t traced_flyby_stage = 0xff;
+#endif
+  JobPlan job;
+  JobStage job_stage = JOB_NONE;
+  const char *job_error = nullptr;
+  Simulator simulator;        // Прогноз текущего задания для ETA в /status
+  StackEstimate job_estimate;
+  uint32_t estimate_start_ms = 0;
+
+  // Очередь заданий в кольце с заранее выделенными слотами: завершённые
+  // записи остаются для /status, пока их не вытеснят новые задания
+  struct QueueSlot
+  {
+    JobRecord record;
+    JobPlan plan;
+  };
+
+  QueueSlot queue[JOB_QUEUE_SIZE];
+  uint8_t queue_head = 0;  // Самая старая запись
+  uint8_t queue_count = 0;
+  uint8_t queue_next = 0;  // Следующее задание к запуску, от queue_head
+  JobRecord *running_job = nullptr; // Запись текущего задания; nullptr - запущено мимо очереди
+
+  QueueSlot &queue_at(uint8_t index) { return queue[(queue_head + index) % JOB_QUEUE_SIZE]; }
+
+  void update_motor_settings()
+  {
+    stepper.set_limits(stack_limits());
+  }
+
+  // Профиль шагов стека: профиль планируется один раз на перемещение,
+  // S-кривая уменьшает вибрацию при остановке перед кадром. Скорость - участка
+  // следующего кадра.
+  MotionLimits stack_limits() const
+  {
+    return Simulator::stack_limits(segment_of(photo_count).speed, settings.s_curve);
+  }
+
+  // Ускоренный ход для позиционирования и возврата к началу стека: кадров на
+  // нём нет, поэтому вибрация после остановки не важна
+  MotionLimits rapid_limits() const
+  {
+    return Simulator::rapid_limits();
+  }
+
+  MotionLimits homing_limits(float speed) const
+  {
+    MotionLimits limits;
+    limits.max_speed = speed * steps_per_mm();
+    limits.acceleration = Config::homing_accel * steps_per_mm();
+    return limits;
+  }
+
+  // Проходы хоуминга без блокирующих задержек: каждый вызов только проверяет
+  // фронт концевика или завершение текущего перемещения
+  void handle_homing()
+  {
+    EndstopEvent edge;
+    check_endstop(); // Подхватывает фронт, пришедший в окно антидребезга
+
+    if (homing_phase == HOMING_BACKOFF)
+    {
+      if (stepper.distance_to_go() != 0)
+        return;
+      if (endstop.pressed())
+      {
+        emergency_stop("Endstop still pressed after back-off");
+        return;
+      }
+      // Медленный подход с запасом в два отъезда: фронт должен найтись на первом из них
+      homing_phase = HOMING_SLOW_SEEK;
+      endstop.arm(true);
+      stepper.set_limits(homing_limits(Config::homing_slow_speed));
+      stepper.move(-2 * um_to_steps(Config::homing_backoff_um));
+      LOG_DEBUG("Homing: slow approach");
+      return;
+    }
+
+    if (!endstop.take_trigger(edge))
+    {
+      if (stepper.distance_to_go() != 0)
+        return;
+      if (homing_phase == HOMING_APPROACH)
+      {
+        homing_phase = HOMING_BACKOFF; // Подошли без фронта - дальше как после отъезда
+      }
+      else if (homing_quick)
+      {
+        LOG_WARN("Re-reference failed, falling back to full homing");
+        state = IDLE;
+        begin_homing();
+      }
+      else
+      {
+        emergency_stop(homing_phase == HOMING_FAST_SEEK ? "Endstop not found" : "Endstop lost on slow approach");
+      }
+      return;
+    }
+
+    // Генератор уже остановлен в прерывании; здесь - только учёт и следующий проход
+    stepper.stop();
+
+    // Значения считаются в аргументах: без уровня DEBUG они не вычисляются вовсе
+    LOG_INFO("=== ENDSTOP HIT (%s) ===", homing_phase == HOMING_SLOW_SEEK ? "slow" : "fast");
+    LOG_DEBUG("Moved: %lld steps (%.2fmm) in %.1fms",
+              (long long)(edge.steps - homing_start_position), steps_to_mm(edge.steps - homing_start_position),
+              (uint32_t)(edge.time_us - homing_start_us) / 1000.0f);
+    LOG_DEBUG("Overrun after edge: %lld steps, reaction: %luus",
+              (long long)(stepper.current_position() - edge.steps), (unsigned long)(hal::micros() - edge.time_us));
+
+    if (homing_phase != HOMING_SLOW_SEEK)
+    {
+      homing_phase = HOMING_BACKOFF;
+      stepper.move(um_to_steps(Config::homing_backoff_um));
+      LOG_DEBUG("Homing: back-off");
+      return;
+    }
+
+    state = HOMING_RETRACT;
+    homing_retract_start = hal::millis();
+    complete_homing(edge.steps);
+  }
+
+  static constexpr float steps_per_mm() { return Mechanics::steps_per_mm; }
+  static constexpr int64_t max_travel_steps() { return Mechanics::max_travel_steps; }
+
+  void enable_motor()
+  {
+    power.enable();
+  }
+
+  // Снятие тока откладывается на окно удержания
+  void disable_motor()
+  {
+    power.release();
+  }
+
+  static constexpr bool delay_valid(int32_t ms) { return ms >= 0 && ms <= JOB_MAX_DELAY_MS; }
+  static constexpr bool in_travel(int64_t um) { return um >= 0 && um <= Config::max_travel_um; }
+
+  void start_next_job()
+  {
+    QueueSlot &slot = queue_at(queue_next++);
+    start_job(slot.plan);
+    running_job = &slot.record;
+    running_job->state = JOB_RUNNING;
+    running_job->started_ms = hal::millis();
+    LOG_INFO("Job %lu started after %lums in queue", (unsigned long)running_job->id,
+             (unsigned long)(running_job->started_ms - running_job->queued_ms));
+  }
+
+  // Ожидающие задания снимаются вместе с остановкой или ошибкой текущего:
+  // ночная серия не должна продолжаться с непроверенного положения
+  void cancel_queued(const char *reason)
+  {
+    for (; queue_next < queue_count; queue_next++)
+    {
+      JobRecord &record = queue_at(queue_next).record;
+      record.state = JOB_ABORTED;
+      record.error = reason;
+      record.started_ms = record.finished_ms = hal::millis(); // Ожидание - до отмены, выполнения не было
+    }
+  }
+
+  void finish_record(JobState result, const char *reason)
+  {
+    if (!running_job)
+      return;
+    running_job->state = result;
+    running_job->error = reason;
+    running_job->photos = photo_count;
+    running_job->finished_ms = hal::millis();
+    LOG_INFO("Job %lu %s in %lums", (unsigned long)running_job->id, get_job_state_string(result),
+             (unsigned long)(running_job->finished_ms - running_job->started_ms));
+    running_job = nullptr;
+  }
+
+  // Задание переходит к следующему этапу, когда рельс закончил текущий
+  void advance_job()
+  {
+    if (job_stage == JOB_NONE)
+      return;
+    if (state == ERROR)
+    {
+      abort_job("Rail error");
+      cancel_queued("Rail error");
+      return;
+    }
+    if (state != IDLE)
+      return;
+
+    switch (job_stage)
+    {
+    case JOB_HOMING:
+      position_for_job();
+      break;
+    case JOB_POSITIONING:
+      begin_stack();
+      break;
+    case JOB_SHOOTING:
+      finish_job();
+      break;
+    default:
+      job_stage = JOB_NONE;
+      finish_record(JOB_DONE, nullptr);
+      break;
+    }
+  }
+
+  // Хоуминг без прерывания задания - для шагов самого задания
+  void begin_homing()
+  {
+    LOG_DEBUG("start_homing() CALLED");
+    if (state == ERROR)
+      return;
+    is_busy = true;
+    enable_motor();
+    state = HOMING;
+    referenced = false;
+    homing_phase = HOMING_FAST_SEEK;
+    homing_quick = false;
+    homing_start_ms = hal::millis();
+    homing_start_us = hal::micros();
+    homing_start_position = stepper.current_position();
+
+    // Положение после включения неизвестно, поэтому поиск - на весь ход с запасом.
+    // Фронт концевика останавливает генератор прямо в прерывании.
+    endstop.arm(true);
+    stepper.set_limits(homing_limits(Config::homing_speed));
+    stepper.move(-max_travel_steps() - um_to_steps(Config::homing_backoff_um));
+
+    LOG_INFO("=== HOMING STARTED ===");
+    LOG_DEBUG("Start position: %lld steps (%.2f mm)",
+              (long long)homing_start_position,
+              steps_to_mm(homing_start_position));
+  }
+
+  // Ход в пределах рельса; ручные команды прерывают задание до вызова
+  void move_to_steps(int64_t target_steps)
+  {
+    if (state != IDLE)
+      return;
+
+    is_busy = true;
+    target_steps = std::clamp(target_steps, (int64_t)0, max_travel_steps());
+
+    // логирование текущего и целевого положения
+    LOG_DEBUG("Move command: %lld steps (current: %lld, pos: %.2fmm)",
+              (long long)target_steps, (long long)stepper.current_position(),
+              get_current_position());
+
+    enable_motor();
+    stepper.set_limits(rapid_limits());
+    stepper.move_to(target_steps);
+    state = MOVING;
+  }
+
+  // Подвод к началу ускоренным ходом; на ходу к разгону подводит сам стек
+  void position_for_job()
+  {
+    job_stage = JOB_POSITIONING;
+    job_estimate = simulator.estimate(job, stepper.current_position());
+    estimate_start_ms = hal::millis();
+    if (job.has_start && !job.settings.continuous)
+      move_to_steps(job.start_steps);
+  }
+
+  void begin_stack()
+  {
+    job_stage = JOB_SHOOTING;
+    is_busy = true;
+    start_position = job.has_start ? job.start_steps : stepper.current_position();
+    photo_count = 0;
+    shooting_stage = SHOT_MOVING;
+    focus_on = false;
+    shutter_on = false;
+    frame_error_steps = 0;
+    frame_error_max_steps = 0;
+    state = SHOOTING;
+
+    enable_motor();
+    if (settings.continuous)
+    {
+      start_flyby();
+      return;
+    }
+    update_motor_settings();
+
+    LOG_INFO("Starting shooting: %d photos, step %ldum, speed %.1f mm/s, before: %dms, after: %dms",
+             settings.total_photos, (long)settings.step_size_um, settings.max_speed,
+             settings.before_shoot_delay, settings.after_shoot_delay);
+  }
+
+  void finish_job()
+  {
+    job_stage = JOB_FINISHING;
+
+    // Предподвод: вместо своего действия после стека - сразу к началу следующего
+    // задания ускоренным ходом; хоуминг следующего задания всё равно сдвинет рельс
+    if (queue_next < queue_count)
+    {
+      const JobPlan &next = queue_at(queue_next).plan;
+      if (next.preposition && next.has_start && !next.home)
+      {
+        LOG_INFO("Pre-positioning for next job: %.2fmm", steps_to_mm(next.start_steps));
+        move_to_steps(next.start_steps);
+        return;
+      }
+    }
+
+    switch (job.after)
+    {
+    case JOB_AFTER_RETURN:
+      LOG_INFO("Returning to start position: %.2fmm", steps_to_mm(start_position));
+      move_to_steps(start_position);
+      break;
+    case JOB_AFTER_PARK:
+      move_to_steps(job.park_steps);
+      break;
+    case JOB_AFTER_HOME:
+      begin_homing();
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Ручная команда посреди задания: иначе остановка после чужого хода выглядит для
+  // advance_job() как конец стека, и задание записывается выполненным
+  void interrupt_job(const char *reason)
+  {
+    if (job_stage == JOB_NONE)
+      return;
+    abort_job(reason);
+    cancel_queued(reason);
+    halt();
+  }
+
+  // Мгновенная остановка с отпусканием камеры; двигатель остаётся под током
+  void halt()
+  {
+    stepper.stop();
+    stepper.clear_position_compare();
+    endstop.disarm();
+    release_camera();
+    state = IDLE;
+  }
+
+  void release_camera()
+  {
+    hal::write<Config::focus_pin>(false);
+    hal::write<Config::shutter_pin>(false);
+    focus_on = false;
+    shutter_on = false;
+    shutter_open = false;
+  }
+
+  // Любой выход из задания отпускает камеру: взведённое сравнение позиции
+  // иначе поднимет затвор на следующем ходу, и опустить его будет некому
+  void abort_job(const char *reason)
+  {
+    stepper.clear_position_compare();
+    release_camera();
+    job_stage = JOB_NONE;
+    job_error = reason;
+    LOG_WARN("Job aborted: %s", reason);
+    finish_record(JOB_ABORTED, reason);
+  }
+
+  const JobPlan::Segment &segment_of(int frame) const
+  {
+    return Simulator::segment_of(job, frame);
+  }
+
+  // Ретракт отсчитывается от позиции на фронте концевика, а не от точки остановки
+  void complete_homing(int64_t edge_steps)
+  {
+    stepper.set_limits(homing_limits(Config::homing_speed));
+
+    int64_t retract_distance = um_to_steps(Config::homing_retract_um);
+    LOG_INFO("=== HOMING COMPLETE - STARTING RETRACT ===");
+    LOG_DEBUG("Current position before retract command: %lld steps", (long long)stepper.current_position());
+    LOG_DEBUG("Target retract distance: %lld steps", (long long)retract_distance);
+    LOG_DEBUG("Current state - %d", (int)state);
+
+    stepper.set_current_position(stepper.current_position() - edge_steps);
+    stepper.move_to(retract_distance);
+    LOG_DEBUG("Target position set for retract: %lld steps", (long long)stepper.target_position());
+  }
+
+  // Конвейер кадра: стадии камеры перекрываются с движением, и темп стека
+  // ограничивают только физические интервалы - успокоение после остановки
+  // (before_shoot_delay), фокусировка (focus_time), удержание спуска
+  // (release_time) и экспозиция (after_shoot_delay, отсчёт от нажатия спуска).
+  // Фокус включается ещё на торможении, следующий шаг начинается сразу после
+  // закрытия окна экспозиции.
+  void handle_shooting()
+  {
+    unsigned long now = hal::millis();
+
+    switch (shooting_stage)
+    {
+    case SHOT_MOVING:
+      if (stepper.distance_to_go() != 0)
+      {
+        stepper.run();
+        if (!focus_on && focus_lead_reached())
+          start_focus(now);
+        return;
+      }
+      disable_motor();
+      if (!focus_on)
+        start_focus(now);
+      stage_start_time = now; // Остановка: отсюда отсчитывается успокоение
+      shooting_stage = SHOT_WAIT_FIRE;
+      break;
+
+    case SHOT_WAIT_FIRE:
+      if (now - stage_start_time >= (unsigned long)settings.before_shoot_delay &&
+          now - focus_start_time >= (unsigned long)settings.focus_time)
+      {
+        hal::write<Config::shutter_pin>(true); // Включаем спуск затвора (добавляем контакт 3)
+        shutter_time = now;
+        shutter_on = true;
+        shooting_stage = SHOT_EXPOSING;
+        LOG_DEBUG("Shutter released (settle %lums, focus %lums)",
+                  now - stage_start_time, now - focus_start_time);
+      }
+      break;
+
+    case SHOT_EXPOSING:
+      if (shutter_on && now - shutter_time >= (unsigned long)settings.release_time)
+      {
+        hal::write<Config::focus_pin>(false);   // Выключаем автофокус
+        hal::write<Config::shutter_pin>(false); // Выключаем спуск затвора
+        shutter_on = false;
+        focus_on = false;
+        photo_count++;
+        LOG_DEBUG("Photo %d taken at %.2fmm", photo_count, get_current_position());
+      }
+      if (shutter_on || now - shutter_time < (unsigned long)settings.after_shoot_delay)
+        break;
+
+      if (photo_count < settings.total_photos)
+      {
+        int64_t new_target = frame_position(photo_count);
+        enable_motor();
+        update_motor_settings(); // Профиль планируется в move_to, поэтому настройки - до него
+        stepper.move_to(new_target);
+        movement_start_time = now;
+        shooting_stage = SHOT_MOVING;
+      }
+      else
+      {
+        state = IDLE;
+        disable_motor();
+        is_busy = false;
+        LOG_INFO("Shooting completed");
+      }
+      break;
+    }
+  }
+
+  // Фокус включается заранее, чтобы закончиться к концу успокоения. Время до
+  // остановки оценивается по линейному торможению: 2 * путь / скорость; на
+  // крейсерском участке оценка завышена, поэтому фокус не включится слишком рано.
+  bool focus_lead_reached() const
+  {
+    int32_t lead_ms = settings.focus_time - settings.before_shoot_delay;
+    if (lead_ms <= 0)
+      return false;
+    float speed = fabsf(stepper.speed());
+    if (speed <= 0)
+      return false;
+    float stop_ms = 2000.0f * llabs(stepper.distance_to_go()) / speed;
+    return stop_ms <= lead_ms;
+  }
+
+  void start_focus(unsigned long now)
+  {
+    hal::write<Config::focus_pin>(true); // Включаем автофокус (замыкаем 1 и 2)
+    focus_on = true;
+    focus_start_time = now;
+  }
+
+  enum ShotStage : uint8_t
+  {
+    SHOT_MOVING,    // Перемещение к кадру (или старт стека с места)
+    SHOT_WAIT_FIRE, // Ожидание успокоения и фокусировки
+    SHOT_EXPOSING   // Спуск нажат, ожидание конца удержания и экспозиции
+  };
+
+  uint8_t shooting_stage = SHOT_MOVING;
+  unsigned long stage_start_time = 0;
+  unsigned long movement_start_time = 0;
+  unsigned long focus_start_time = 0;
+  unsigned long shutter_time = 0;
+  bool focus_on = false;
+  bool shutter_on = false;
+
+  // Съёмка на ходу: разгон до начала стека, фокусировка, проход с постоянной
+  // скоростью. Затвор открывается прямо в прерывании генератора шагов на шаге,
+  // которым рельс пересёк плановую позицию кадра; задача движения только
+  // отпускает затвор и взводит сравнение для следующего кадра.
+  enum FlybyStage : uint8_t
+  {
+    FLYBY_RUNUP,
+    FLYBY_FOCUS,
+    FLYBY_PASS
+  };
+
+  FlybyStage flyby_stage = FLYBY_RUNUP;
+  float flyby_speed = 0; // Скорость прохода в мм/с
+  int64_t frame_target = 0;
+  bool shutter_open = false;
+  volatile bool frame_fired = false;
+  volatile int64_t frame_fired_steps = 0;
+  int32_t frame_error_steps = 0;
+  int32_t frame_error_max_steps = 0;
+
+  int64_t frame_position(int index) const
+  {
+    return Simulator::frame_position(job, start_position, index);
+  }
+
+  MotionLimits flyby_limits() const
+  {
+    return Simulator::flyby_limits(flyby_speed);
+  }
+
+  void start_flyby()
+  {
+    flyby_speed = Simulator::flyby_speed(settings);
+    if (!(flyby_speed > 0))
+    {
+      // Пустой проход «закончился бы» без кадров: задание прерывается с причиной
+      state = IDLE;
+      disable_motor();
+      is_busy = false;
+      abort_job("Fly-by speed is zero");
+      return;
+    }
+    int64_t ramp = Simulator::flyby_ramp(flyby_limits());
+    int64_t runup = start_position - ramp;
+    if (runup < 0)
+      runup = 0; // Кадры всё равно сработают по позиции, но первый - ещё на разгоне
+
+    LOG_INFO("Starting fly-by: %d photos, step %ldum, speed %.2f mm/s, run-up %lld steps",
+             settings.total_photos, (long)settings.step_size_um, flyby_speed,
+             (long long)(start_position - runup));
+
+    flyby_stage = FLYBY_RUNUP;
+    stepper.set_limits(rapid_limits());
+    stepper.move_to(runup);
+  }
+
+  static void STEP_ISR_ATTR on_frame_position(void *context, int64_t position)
+  {
+    MacroRail *self = static_cast<MacroRail *>(context);
+    hal::write<Config::shutter_pin>(true);
+    self->frame_fired_steps = position;
+    self->frame_fired = true;
+  }
+
+  void arm_next_frame()
+  {
+    frame_target = frame_position(photo_count);
+    frame_fired = false;
+    stepper.set_position_compare(frame_target, on_frame_position, this);
+  }
+
+  void handle_flyby()
+  {
+    stepper.run();
+    switch (flyby_stage)
+    {
+    case FLYBY_RUNUP:
+      if (stepper.distance_to_go() != 0)
+        return;
+      hal::write<Config::focus_pin>(true); // Полунажатие держится весь проход и убирает задержку затвора
+      stage_start_time = hal::millis();
+      flyby_stage = FLYBY_FOCUS;
+      break;
+
+    case FLYBY_FOCUS:
+      if (hal::millis() - stage_start_time <= (unsigned long)settings.focus_time)
+        return;
+      {
+        // Торможение - после последнего кадра, чтобы все кадры шли на крейсерской скорости
+        MotionLimits limits = flyby_limits();
+        int64_t ramp = Simulator::flyby_ramp(limits);
+        int64_t pass_end = frame_position(settings.total_photos - 1) + ramp;
+        arm_next_frame();
+        stepper.set_limits(limits);
+        stepper.move_to(std::clamp(pass_end, (int64_t)0, max_travel_steps()));
+        flyby_stage = FLYBY_PASS;
+      }
+      break;
+
+    case FLYBY_PASS:
+      if (frame_fired)
+      {
+        frame_fired = false;
+        shutter_open = true;
+        stage_start_time = hal::millis();
+        int32_t error = (int32_t)(frame_fired_steps - frame_target);
+        frame_error_steps = error;
+        if (llabs(error) > llabs(frame_error_max_steps))
+          frame_error_max_steps = error;
+        photo_count++;
+        LOG_DEBUG("Photo %d fired at %lld steps (planned %lld, error %ld)",
+                  photo_count, (long long)frame_fired_steps, (long long)frame_target, (long)error);
+      }
+
+      if (shutter_open && hal::millis() - stage_start_time > (unsigned long)settings.release_time)
+      {
+        hal::write<Config::shutter_pin>(false);
+        shutter_open = false;
+        if (photo_count < settings.total_photos)
+          arm_next_frame(); // Позиция уже пройдена - сработает на следующем шаге с ошибкой
+      }
+
+      if (!shutter_open && stepper.distance_to_go() == 0)
+      {
+        stepper.clear_position_compare();
+        release_camera();
+        state = IDLE;
+        disable_motor();
+        is_busy = false;
+        LOG_INFO("Fly-by completed: %d/%d photos, max error %ld steps",
+                 photo_count, settings.total_photos, (long)frame_error_max_steps);
+      }
+      break;
+    }
+  }
+
+  // Смены состояния и этапов съёмки - в трассу шагов рядом с импульсами
+  void trace_transitions()
+  {
+#if STEP_TRACE
+    if (traced_state != state)
+    {
+      traced_state = state;
+      TRACE_EVENT(TRACE_STATE, traced_state);
+    }
+    if (traced_shot_stage != shooting_stage)
+    {
+      traced_shot_stage = shooting_stage;
+      TRACE_EVENT(TRACE_SHOT_STAGE, traced_shot_stage);
+    }
+    if (traced_flyby_stage != flyby_stage)
+    {
+      traced_flyby_stage = flyby_stage;
+      TRACE_EVENT(TRACE_FLYBY_STAGE, traced_flyby_stage);
+    }
+#endif
+  }
+
+  void handle_error()
+  {
+    // digitalWrite(STATUS_LED, millis() % 200 < 100); // Больше не используется
+  }
+
+  void handle_idle()
+  {
+    // digitalWrite(STATUS_LED, millis() % 1000 < 500); // Больше не используется
+  }
+
+  void emergency_stop(const char *reason)
+  {
+    stepper.stop();
+    stepper.clear_position_compare();
+    release_camera();
+    referenced = false; // При аварийной остановке шаги могли потеряться
+    power.disable(); // Принудительное отключение без окна удержания
+    state = ERROR;
+    LOG_ERROR("EMERGENCY STOP: %s", reason);
+  }
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "duration_histogram.h"
+#include "macro_rail.h"
+
+// Метрики задачи движения для /metrics. Итерация без движения и без
+// съёмки стоит два чтения счётчика тактов и одно добавление в гистограммы.
+class MotionMetrics
+{
+public:
+  DurationHistogram loop_period; // Между началами итераций задачи движения
+  DurationHistogram update_cost; // rail.update()
+  DurationHistogram frame_time;  // Между соседними кадрами стека
+
+  // Вызывается задачей движения в начале итерации
+  void begin_iteration()
+  {
+    uint32_t start = CycleClock::now();
+    if (started)
+      loop_period.add_us(CycleClock::to_us(start - iteration_start));
+    iteration_start = start;
+    started = true;
+  }
+
+  // update_cycles - длительность rail.update(); speed - заданная генератору
+  // скорость в шаг/с, по ней копится план перемещения
+  void record(uint32_t update_cycles, const MacroRailBase::Status &status, float speed)
+  {
+    update_cost.add_us(CycleClock::to_us(update_cycles));
+
+    uint32_t now_us = micros();
+    track_frames(status, now_us);
+    if (speed != 0 || in_move)
+      track_rate(status, speed < 0 ? -speed : speed, now_us);
+  }
+
+  // Средние за последнее завершённое перемещение, шаг/с
+  float commanded_rate() const { return last_commanded_rate; }
+  float achieved_rate() const { return last_achieved_rate; }
+  uint32_t moves() const { return move_count; }
+
+private:
+  uint32_t iteration_start = 0;
+  bool started = false;
+
+  int last_photo_count = 0;
+  uint32_t last_frame_us = 0;
+
+  bool in_move = false;
+  uint32_t move_start_us = 0;
+  uint32_t last_sample_us = 0;
+  int64_t move_start_steps = 0;
+  float commanded_steps = 0; // Интеграл заданной скорости по времени
+  float last_commanded_rate = 0;
+  float last_achieved_rate = 0;
+  uint32_t move_count = 0;
+
+  // Период кадра - между соседними кадрами одного стека; новый стек начинает отсчёт заново
+  void track_frames(const MacroRailBase::Status &status, uint32_t now_us)
+  {
+    if (status.photo_count == last_photo_count)
+      return;
+    if (status.photo_count == last_photo_count + 1 && last_photo_count > 0)
+      frame_time.add_us(now_us - last_frame_us);
+    last_photo_count = status.photo_count;
+    last_frame_us = now_us;
+  }
+
+  // Достигнутая скорость против заданной за перемещение: при опросном
+  // генераторе медленная задача движения отстаёт от плана AccelStepper
+  void track_rate(const MacroRailBase::Status &status, float speed, uint32_t now_us)
+  {
+    if (!in_move)
+    {
+      in_move = true;
+      move_start_us = now_us;
+      last_sample_us = now_us;
+      move_start_steps = status.steps;
+      commanded_steps = 0;
+      return;
+    }
+    commanded_steps += speed * (now_us - last_sample_us) * 1e-6f;
+    last_sample_us = now_us;
+    if (speed != 0)
+      return;
+
+    in_move = false;
+    float duration = (now_us - move_start_us) * 1e-6f;
+    if (duration <= 0)
+      return;
+    int64_t moved = status.steps - move_start_steps;
+    last_commanded_rate = commanded_steps / duration;
+    last_achieved_rate = (moved < 0 ? -moved : moved) / duration;
+    move_count++;
+  }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+
+#if defined(ESP32)
+#include <esp_attr.h>
+#define STEP_ISR_ATTR IRAM_ATTR // Код, вызываемый из прерывания таймера, должен лежать в IRAM
+#else
+#define STEP_ISR_ATTR
+#endif
+
+// Ограничения одного перемещения
+struct MotionLimits
+{
+  float max_speed = 1;    // Скорость в шаг/с
+  float acceleration = 0; // Ускорение в шаг/с^2, 0 - сразу крейсерская скорость
+  float jerk = 0;         // Рывок в шаг/с^3, 0 - трапеция, иначе S-кривая
+};
+
+// Ступень таблицы разгона: count шагов с интервалом interval (тики таймера * 256)
+struct RampSegment
+{
+  uint32_t interval;
+  uint32_t count;
+};
+
+// Заранее рассчитанный профиль перемещения.
+// Планирование (float) выполняется один раз на перемещение. Выдача интервала -
+// O(1) целочисленная операция: разгон идёт по таблице вперёд, торможение - по
+// той же таблице назад, дробная часть тика накапливается в формате Q8.
+class StepSchedule
+{
+public:
+  static const uint16_t MAX_RAMP_SEGMENTS = 256; // Короче - по записи на каждый шаг разгона
+  static const uint32_t MIN_INTERVAL = 50;       // Не чаще 200 тыс. шагов/с при 10 МГц
+
+  void plan(uint32_t steps, const MotionLimits &limits, uint32_t timer_hz);
+  void clear();
+
+  // Интервал до следующего шага в тиках, 0 - расписание исчерпано
+  STEP_ISR_ATTR uint32_t next_interval()
+  {
+    if (left_in_segment == 0 && !next_segment())
+      return 0;
+    left_in_segment--;
+    remaining_steps--;
+    fraction += interval_q8;
+    uint32_t ticks = fraction >> 8;
+    fraction &= 0xff;
+    return ticks;
+  }
+
+  uint32_t total_steps() const { return planned_steps; }
+  uint32_t remaining() const { return remaining_steps; }
+  uint32_t ramp_steps() const { return ramp_total; }
+  uint16_t ramp_size() const { return ramp_count; }
+  const RampSegment &ramp_segment(uint16_t i) const { return ramp[i]; }
+  uint32_t cruise_interval() const { return cruise_q8 >> 8; }
+
+  // Время от начала перемещения до шага номер step (с 1) в тиках - сумма первых
+  // step интервалов next_interval() без их перебора: O(1) на крейсерском участке
+  uint64_t ticks_until(uint32_t step) const;
+
+private:
+  enum Phase : uint8_t
+  {
+    RAMP_UP,
+    CRUISE,
+    RAMP_DOWN,
+    DONE
+  };
+
+  RampSegment ramp[MAX_RAMP_SEGMENTS];
+  uint16_t ramp_count = 0;
+  uint32_t ramp_total = 0; // Шагов в разгоне (и столько же в торможении)
+  uint64_t ramp_q8 = 0;    // Длительность разгона в тиках * 256
+  uint32_t cruise_steps = 0;
+  uint32_t cruise_q8 = 0;
+
+  Phase phase = DONE;
+  uint16_t index = 0;
+  uint32_t left_in_segment = 0;
+  uint32_t interval_q8 = 0;
+  uint32_t fraction = 0;
+  uint32_t planned_steps = 0;
+  volatile uint32_t remaining_steps = 0;
+
+  STEP_ISR_ATTR bool next_segment()
+  {
+    switch (phase)
+    {
+    case RAMP_UP:
+      if (index + 1 < ramp_count)
+      {
+        index++;
+        break;
+      }
+      phase = CRUISE;
+      if (cruise_steps > 0)
+      {
+        left_in_segment = cruise_steps;
+        interval_q8 = cruise_q8;
+        return true;
+      }
+      // fallthrough
+    case CRUISE:
+      phase = RAMP_DOWN;
+      index = ramp_count;
+      // fallthrough
+    case RAMP_DOWN:
+      if (index == 0)
+      {
+        phase = DONE;
+        return false;
+      }
+      index--;
+      break;
+    default:
+      return false;
+    }
+    left_in_segment = ramp[index].count;
+    interval_q8 = ramp[index].interval;
+    return true;
+  }
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "hal.h"
+
+// Питание драйвера шагового двигателя. После движения ток удерживается
+// hold_ms, и кадры стека, идущие чаще, не снимают питание между шагами:
+// нет потери микрошага и задержки на включение. Повторное включение уже
+// запитанного драйвера - только проверка флага, без записи в GPIO.
+template <uint8_t Pin, bool ActiveLevel>
+class PowerManager
+{
+public:
+  PowerManager(uint32_t hold_ms, uint32_t wake_us) : hold_ms(hold_ms),
+                                                     wake_us(wake_us)
+  {
+  }
+
+  void begin()
+  {
+    hal::pin_output(Pin);
+    hal::write<Pin>(!ActiveLevel);
+  }
+
+  void enable()
+  {
+    release_pending = false;
+    if (energised)
+      return;
+    hal::write<Pin>(ActiveLevel);
+    hal::delay_us(wake_us); // Время выхода драйвера из сна
+    energised = true;
+    energised_since = hal::millis();
+    enable_transitions++;
+  }
+
+  // Движение закончено: питание снимется по истечении окна удержания
+  void release()
+  {
+    if (!energised || release_pending)
+      return;
+    if (hold_ms == 0)
+    {
+      disable();
+      return;
+    }
+    release_pending = true;
+    release_time = hal::millis();
+  }
+
+  // Немедленное отключение (аварийная остановка)
+  void disable()
+  {
+    release_pending = false;
+    if (!energised)
+      return;
+    hal::write<Pin>(!ActiveLevel);
+    energised = false;
+    energised_total_ms += hal::millis() - energised_since;
+    disable_transitions++;
+  }
+
+  void update()
+  {
+    if (release_pending && hal::millis() - release_time >= hold_ms)
+      disable();
+  }
+
+  bool is_energised() const { return energised; }
+  uint32_t enable_count() const { return enable_transitions; }
+  uint32_t disable_count() const { return disable_transitions; }
+
+  // Суммарное время под током, включая текущий интервал
+  uint32_t energised_ms() const
+  {
+    return energised_total_ms + (energised ? hal::millis() - energised_since : 0);
+  }
+
+private:
+  const uint32_t hold_ms;
+  const uint32_t wake_us;
+
+  bool energised = false;
+  bool release_pending = false;
+  unsigned long release_time = 0;
+  unsigned long energised_since = 0;
+  uint32_t energised_total_ms = 0;
+  uint32_t enable_transitions = 0;
+  uint32_t disable_transitions = 0;
+};
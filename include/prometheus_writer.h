@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "duration_histogram.h"
+#include "http_request.h"
+
+// Ответ в текстовом формате Prometheus, частями: строки копятся в буфере
+// вызывающего и уходят клиентом через send_chunk(), когда следующая не
+// помещается. Полный ответ с гистограммами больше буфера, но кучи не требует.
+class PrometheusWriter
+{
+public:
+  PrometheusWriter(HttpRequest &request, char *buffer, size_t size)
+      : request(request), buffer(buffer), size(size)
+  {
+    request.begin_stream(200, "text/plain; version=0.0.4");
+  }
+
+  PrometheusWriter &gauge(const char *name, const char *help, double value)
+  {
+    header(name, help, "gauge");
+    line("%s %.10g\n", name, value);
+    return *this;
+  }
+
+  PrometheusWriter &counter(const char *name, const char *help, double value)
+  {
+    header(name, help, "counter");
+    line("%s %.10g\n", name, value);
+    return *this;
+  }
+
+  // Границы и сумма - в секундах, как принято в Prometheus
+  PrometheusWriter &histogram(const char *name, const char *help, const DurationHistogram &histogram)
+  {
+    header(name, help, "histogram");
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+    {
+      total += histogram.bucket(i);
+      line("%s_bucket{le=\"%.9g\"} %lu\n", name, DurationHistogram::bucket_limit_us(i) * 1e-6, (unsigned long)total);
+    }
+    total += histogram.bucket(HISTOGRAM_BUCKETS - 1);
+    line("%s_bucket{le=\"+Inf\"} %lu\n", name, (unsigned long)total);
+    line("%s_sum %.6f\n", name, histogram.sum() * 1e-6);
+    line("%s_count %lu\n", name, (unsigned long)total); // По корзинам: счётчик мог измениться во время выдачи
+    return *this;
+  }
+
+  void finish()
+  {
+    flush();
+    if (connected)
+      request.end_stream();
+  }
+
+private:
+  HttpRequest &request;
+  char *buffer;
+  size_t size;
+  size_t used = 0;
+  bool connected = true;
+
+  void header(const char *name, const char *help, const char *type)
+  {
+    line("# HELP %s %s\n", name, help);
+    line("# TYPE %s %s\n", name, type);
+  }
+
+  __attribute__((format(printf, 2, 3))) void line(const char *format, ...)
+  {
+    for (int attempt = 0; attempt < 2 && connected; attempt++)
+    {
+      va_list args;
+      va_start(args, format);
+      int written = vsnprintf(buffer + used, size - used, format, args);
+      va_end(args);
+      if (written >= 0 && (size_t)written < size - used)
+      {
+        used += written;
+        return;
+      }
+      flush(); // Строка не поместилась: отправляем накопленное и пишем её заново
+    }
+  }
+
+  void flush()
+  {
+    if (used && connected)
+      connected = request.send_chunk(buffer, used);
+    used = 0;
+  }
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <math.h>
+
+#include "http_request.h"
+#include "json_writer.h"
+#include "macro_rail.h"
+#include "stack_simulator.h"
+#include "web_ui.h"
+
+// Части обработчиков веб-API, не зависящие от глобальных объектов прошивки:
+// обработчики в main.cpp добавляют к ним Wi-Fi, журнал и очередь команд,
+// а test/test_bench меряет их на хосте и на плате.
+
+// Интерфейс собран заранее (tools/build_web_ui.py) и отдаётся из flash как есть:
+// без копирования в String и без подстановок. Повторная загрузка - 304 по ETag.
+inline void send_web_ui(HttpRequest &request)
+{
+  request.send_header("ETag", WEB_UI_ETAG);
+  request.send_header("Cache-Control", "no-cache"); // Хранить, но сверять ETag при каждой загрузке
+  if (request.header_equals("If-None-Match", WEB_UI_ETAG))
+  {
+    request.send(304, "text/html", "");
+    return;
+  }
+  request.send_header("Content-Encoding", "gzip");
+  request.send(200, "text/html", (const char *)WEB_UI_GZ, WEB_UI_GZ_SIZE);
+}
+
+inline const char *status_state_name(MacroRailBase::State state)
+{
+  switch (state)
+  {
+  case MacroRailBase::IDLE:
+    return "Ready";
+  case MacroRailBase::HOMING:
+  case MacroRailBase::HOMING_RETRACT:
+    return "Homing";
+  case MacroRailBase::MOVING:
+    return "Moving";
+  case MacroRailBase::SHOOTING:
+    return "Shooting";
+  case MacroRailBase::ERROR:
+    return "ERROR";
+  default:
+    return "Unknown";
+  }
+}
+
+// Поля /status из снимка рельса; now - hal::millis() для времени заданий.
+// Объект открывает и закрывает вызывающий.
+template <typename Rail>
+void write_rail_status(JsonWriter &json, const MacroRailBase::Status &status, uint32_t now)
+{
+  json.field("position", Rail::steps_to_mm(status.steps))
+      .field("target", Rail::steps_to_mm(status.target_steps))
+      .field("steps", (long long)status.steps)
+      .field("state", status_state_name(status.state))
+      .field("photo_count", status.photo_count)
+      .field("total_photos", status.settings.total_photos)
+      .field("shooting", status.state == MacroRailBase::SHOOTING)
+      .field("endstop", status.endstop)
+      .field("referenced", status.referenced)
+      .field("homing_time_ms", status.homing_time_ms)
+      .field("frame_error_um", status.frame_error_steps * 1000.0f / Rail::Mechanics::steps_per_mm, 1)
+      .field("frame_error_max_um", status.frame_error_max_steps * 1000.0f / Rail::Mechanics::steps_per_mm, 1)
+      .field("job", MacroRailBase::get_job_stage_string(status.job_stage))
+      .field("estimate_ms", status.job_estimate_ms)
+      .field("eta_ms", status.job_eta_ms);
+  if (status.job_error)
+    json.field("job_error", status.job_error);
+
+  // Очередь заданий: время ожидания и выполнения; у текущего - до этого момента
+  json.begin_array("queue");
+  for (uint8_t i = 0; i < status.job_count; i++)
+  {
+    const MacroRailBase::JobRecord &job = status.jobs[i];
+    uint32_t started = job.state == MacroRailBase::JOB_QUEUED ? now : job.started_ms;
+    uint32_t finished = job.state == MacroRailBase::JOB_RUNNING ? now : job.finished_ms;
+    json.begin_object()
+        .field("id", job.id)
+        .field("state", MacroRailBase::get_job_state_string(job.state))
+        .field("frames", (unsigned)job.frames)
+        .field("photos", (unsigned)job.photos)
+        .field("wait_ms", started - job.queued_ms)
+        .field("run_ms", job.state == MacroRailBase::JOB_QUEUED ? 0 : finished - started);
+    if (job.error)
+      json.field("error", job.error);
+    json.end_object();
+  }
+  json.end_array();
+
+  json.begin_object("driver")
+      .field("energised", status.driver_energised)
+      .field("energised_ms", status.driver_energised_ms)
+      .field("enables", status.driver_enable_count)
+      .end_object();
+}
+
+// Прогноз задания для /estimate и /job?dry_run=1. Объект открывает и закрывает вызывающий.
+template <typename Rail>
+void write_stack_estimate(JsonWriter &json, const StackEstimate &estimate)
+{
+  json.field("total_ms", estimate.total_ms)
+      .field("frames", (unsigned)estimate.frames)
+      .field("final_position", Rail::steps_to_mm(estimate.final_steps))
+      .field("homing", estimate.homing)
+      .begin_object("phases")
+      .field("positioning_ms", estimate.positioning_ms)
+      .field("runup_ms", estimate.runup_ms)
+      .field("focus_ms", estimate.focus_ms)
+      .field("moving_ms", estimate.moving_ms)
+      .field("settle_ms", estimate.settle_ms)
+      .field("exposure_ms", estimate.exposure_ms)
+      .field("finishing_ms", estimate.finishing_ms)
+      .end_object();
+}
+
+// Параметры /start поверх текущих настроек; отсутствующие и нечисловые не меняют их
+inline void parse_start_args(HttpRequest &request, MacroRailBase::Settings &settings, bool &return_to_start)
+{
+  long number;
+  float value;
+  if (request.arg_int("photos", number)) settings.total_photos = number;
+  if (request.arg_float("step", value)) settings.step_size_um = lroundf(value * 1000.0f);
+  if (request.arg_float("speed", value)) settings.max_speed = value;
+  if (request.arg_int("before", number)) settings.before_shoot_delay = number;
+  if (request.arg_int("after", number)) settings.after_shoot_delay = number;
+  if (request.arg_int("focus_time", number)) settings.focus_time = number;
+  if (request.arg_int("release_time", number)) settings.release_time = number;
+  if (request.has_arg("scurve")) settings.s_curve = !request.arg_equals("scurve", "0");
+  if (request.has_arg("continuous")) settings.continuous = request.arg_equals("continuous", "1");
+  return_to_start = request.arg_equals("return_to_start", "1");
+}
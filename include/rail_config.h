@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+// Конфигурации рельса: пины, механика и динамика. Все поля constexpr, поэтому в
+// MacroRail<Config> перевод единиц, пределы хода и маски пинов сворачиваются в
+// константы при компиляции. Новый вариант рельса - наследник DefaultRailConfig,
+// в котором переопределены отличающиеся поля.
+struct DefaultRailConfig
+{
+  // Конфигурация пинов
+  static constexpr uint8_t step_pin = 4;        // Пин управления шагами
+  static constexpr uint8_t dir_pin = 16;        // Пин управления направлением
+  static constexpr uint8_t endstop_pin = 17;    // Пин концевика
+  static constexpr uint8_t enable_pin = 5;      // Пин управления питанием драйвера
+  static constexpr bool enable_active = false;  // Уровень активного состояния ENABLE (LOW - включен)
+  static constexpr bool endstop_active = false; // Уровень активного состояния концевика
+  static constexpr bool invert_dir = true;      // Инверсия DIR
+
+  // Пины управления фотоаппаратом через транзисторы/реле
+  static constexpr uint8_t focus_pin = 18;   // IN1 на модуле
+  static constexpr uint8_t shutter_pin = 19; // IN2 на модуле
+
+  // Механические параметры
+  static constexpr uint32_t microsteps = 16;
+  static constexpr uint32_t steps_per_revolution = 100;
+  static constexpr uint32_t screw_lead_um = 2000; // Шаг винта в мкм
+  static constexpr uint32_t gear_ratio_num = 109; // Передаточное число редуктора - точная дробь
+  static constexpr uint32_t gear_ratio_den = 12;
+  static constexpr int32_t max_travel_um = 97000; // Максимальное расстояние от ноля до конца
+
+  // Динамика
+  static constexpr float homing_speed = 10.0;        // Скорость быстрого поиска концевика в мм/с
+  static constexpr float homing_slow_speed = 0.5;    // Скорость медленного повторного подхода в мм/с
+  static constexpr float homing_accel = 200.0;       // Ускорение хоуминга в мм/с^2
+  static constexpr int32_t homing_backoff_um = 2000; // Отъезд от концевика перед медленным подходом
+  static constexpr int32_t homing_retract_um = 1000; // Отъезд от фронта концевика до нуля
+  static constexpr float default_accel = 100.0;      // Ускорение по умолчанию в мм/с^2
+  static constexpr float default_jerk = 2000.0;      // Рывок S-кривой для шагов стека в мм/с^3
+  static constexpr float rapid_speed = 8.0;          // Ускоренный ход вне съёмки в мм/с
+  static constexpr float rapid_accel = 50.0;         // Ускорение ускоренного хода в мм/с^2
+  static constexpr uint32_t debounce_ms = 50;        // Антидребезг концевика
+  static constexpr uint32_t driver_hold_ms = 5000;   // Удержание тока после движения, 0 - снимать сразу
+  static constexpr uint32_t driver_wake_us = 100;    // Задержка после включения драйвера
+};
+
+// Вариант без редуктора: мотор напрямую на винте с шагом 1 мм, короче ход
+struct DirectDriveRailConfig : DefaultRailConfig
+{
+  static constexpr uint32_t screw_lead_um = 1000;
+  static constexpr uint32_t gear_ratio_num = 1;
+  static constexpr uint32_t gear_ratio_den = 1;
+  static constexpr int32_t max_travel_um = 50000;
+};
+
+constexpr int64_t divide_rounded(int64_t value, int64_t divisor)
+{
+  return value >= 0 ? (value + divisor / 2) / divisor : -((-value + divisor / 2) / divisor);
+}
+
+// Величины, выводимые из конфигурации при компиляции
+template <typename Config>
+struct RailMechanics
+{
+  // Шагов на мкм в виде точной дроби: позиции хранятся в шагах (int64),
+  // миллиметры появляются только на границе веб-API
+  static constexpr int64_t steps_per_um_num =
+      (int64_t)Config::steps_per_revolution * Config::microsteps * Config::gear_ratio_num;
+  static constexpr int64_t steps_per_um_den = (int64_t)Config::gear_ratio_den * Config::screw_lead_um;
+  static constexpr float steps_per_mm = (float)steps_per_um_num * 1000 / steps_per_um_den;
+  static constexpr int64_t max_travel_steps =
+      divide_rounded((int64_t)Config::max_travel_um * steps_per_um_num, steps_per_um_den);
+
+  // Отпечаток механики: данные в шагах, сохранённые с другой конфигурацией, не годятся
+  static constexpr uint32_t signature =
+      (uint32_t)(steps_per_um_num * 2654435761LL) ^ (uint32_t)(steps_per_um_den * 40503) ^ (uint32_t)max_travel_steps;
+
+  static constexpr int64_t um_to_steps(int64_t um) { return divide_rounded(um * steps_per_um_num, steps_per_um_den); }
+  static constexpr int64_t steps_to_um(int64_t steps) { return divide_rounded(steps * steps_per_um_den, steps_per_um_num); }
+};
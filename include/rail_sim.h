@@ -0,0 +1,131 @@
+#pragma once
+
+#if !defined(ARDUINO)
+
+#include "macro_rail.h"
+#include "step_generator_sim.h"
+
+#define SIM_TICK_US 1000       // Период update() в симуляции, как у задачи движения
+#define SIM_TIMER_HZ 10000000  // Частота таймера шагов, как на плате
+
+// Рельс целиком на хосте: MacroRail с SimStepGenerator на виртуальном времени
+// и модель механики - концевик срабатывает, когда каретка доезжает до него.
+// Уровень концевика меняется на том шаге, на котором каретка его достигла,
+// поэтому остановка в «прерывании» и антидребезг работают как на плате.
+// Затвор наблюдается по пину: позиции кадров записываются в frame_steps().
+// Один экземпляр на процесс: платформа (время, пины) общая.
+template <typename Config>
+class RailSim
+{
+public:
+  typedef MacroRail<Config> Rail;
+  typedef RailMechanics<Config> Mechanics;
+
+  // start_mm - расстояние от фронта концевика до каретки при включении
+  explicit RailSim(float start_mm) : generator(SIM_TIMER_HZ), rail(generator)
+  {
+    carriage = lroundf(start_mm * Mechanics::steps_per_mm);
+    generator.set_step_callback(on_step, this);
+    sim_platform().watch_outputs(on_output, this);
+    update_endstop();
+    generator.begin();
+    rail.begin();
+  }
+
+  ~RailSim()
+  {
+    sim_platform().watch_outputs(nullptr, nullptr);
+  }
+
+  // Один период задачи движения: шаги, срок которых наступил, затем update()
+  void tick()
+  {
+    advance();
+    rail.update();
+  }
+
+  // Период вперёд без update(): бенчмарк вызывает его сам, чтобы замерить отдельно
+  void advance()
+  {
+    uint64_t until = sim_platform().now_us() + SIM_TICK_US;
+    generator.advance_to(until * ticks_per_us());
+    sim_platform().set_time(until);
+  }
+
+  void run_for_ms(uint32_t ms)
+  {
+    for (uint32_t i = 0; i < ms * 1000 / SIM_TICK_US; i++)
+      tick();
+  }
+
+  // Прогон до выполнения условия; false - не дождались за timeout_ms
+  template <typename Condition>
+  bool run_until(Condition done, uint32_t timeout_ms)
+  {
+    uint64_t deadline = sim_platform().now_us() + timeout_ms * 1000ULL;
+    while (!done(rail))
+    {
+      if (sim_platform().now_us() >= deadline)
+        return false;
+      tick();
+    }
+    return true;
+  }
+
+  // Очередь пуста: следующее задание запускается в том же update(), что завершил предыдущее
+  bool run_until_idle(uint32_t timeout_ms)
+  {
+    return run_until([](Rail &r)
+                     {
+                       typename Rail::Status status = r.get_status();
+                       return status.state == Rail::IDLE && status.job_stage == Rail::JOB_NONE;
+                     },
+                     timeout_ms);
+  }
+
+  uint32_t now_ms() const { return (uint32_t)(sim_platform().now_us() / 1000); }
+
+  // Положение каретки от фронта концевика в шагах: по импульсам, а не по счётчику
+  // генератора, который хоуминг обнуляет
+  int64_t carriage_steps() const { return carriage; }
+  bool endstop_pressed() const { return carriage_steps() <= 0; }
+
+  uint64_t pulse_count() const { return pulses; }
+  uint32_t frame_count() const { return frames; }
+  int64_t frame_steps(uint32_t i) const { return frame_positions[i]; }
+  void clear_frames() { frames = 0; }
+
+  SimStepGenerator generator;
+  Rail rail;
+
+private:
+  int64_t carriage;
+  uint64_t pulses = 0;
+  uint32_t frames = 0;
+  int64_t frame_positions[JOB_MAX_FRAMES];
+
+  static uint64_t ticks_per_us() { return SIM_TIMER_HZ / 1000000; }
+
+  void update_endstop()
+  {
+    sim_platform().set_input(Config::endstop_pin, endstop_pressed() == Config::endstop_active);
+  }
+
+  static void on_step(void *context, uint64_t tick, int64_t)
+  {
+    RailSim *self = static_cast<RailSim *>(context);
+    sim_platform().set_time(tick / ticks_per_us()); // Прерывание концевика видит время шага
+    self->pulses++;
+    self->carriage += self->generator.step_direction();
+    self->update_endstop();
+  }
+
+  static void on_output(void *context, uint8_t pin, bool high)
+  {
+    RailSim *self = static_cast<RailSim *>(context);
+    if (pin == Config::shutter_pin && high && self->frames < JOB_MAX_FRAMES)
+      self->frame_positions[self->frames++] = self->generator.current_position();
+  }
+};
+
+#endif
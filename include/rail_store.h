@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "macro_rail.h"
+
+#define STORE_PERIOD_MS 100           // Опрос снимка состояния задачей сохранения
+#define STORE_SETTINGS_DELAY_MS 2000  // Настройки пишутся, когда перестали меняться
+#define STORE_POSITION_DELAY_MS 1000  // Позиция - когда рельс столько простоял
+
+// Настройки стека и последняя позиция в NVS с отложенной записью. Позиция
+// пишется только в покое вместе с признаком чистой остановки; с началом
+// движения признак снимается одной записью. Поэтому после сброса или
+// просадки питания позиции верят, только если рельс тогда стоял. Запись
+// во flash - только при изменении: стек из сотни кадров - это две записи.
+class RailStore
+{
+public:
+  // signature - отпечаток механики: сохранённая позиция в шагах другой
+  // конфигурации рельса не восстанавливается
+  explicit RailStore(uint32_t signature) : signature(signature) {}
+
+  // Чтение при загрузке, до запуска задачи движения
+  bool load_settings(MacroRailBase::Settings &settings);
+  bool load_position(int64_t &steps);
+
+  // Отложенная запись; вызывается периодически из одной задачи
+  void track(const MacroRailBase::Status &status);
+
+  uint32_t writes() const { return write_count; }
+
+private:
+  struct StoredSettings
+  {
+    uint8_t version;
+    MacroRailBase::Settings settings;
+  };
+
+  // Позиция и признак - одна запись NVS, поэтому меняются атомарно
+  struct StoredPosition
+  {
+    uint32_t signature;
+    int64_t steps;
+    bool clean; // Рельс стоял на этой позиции привязанным
+  };
+
+  const uint32_t signature;
+  StoredSettings saved_settings = {};
+  StoredPosition saved_position = {};
+  MacroRailBase::Settings pending_settings;
+  uint32_t settings_changed_ms = 0;
+  bool settings_pending = false;
+  int64_t rest_steps = 0;
+  uint32_t rest_since_ms = 0;
+  bool at_rest = false;
+  uint32_t write_count = 0;
+
+  void write_settings(const MacroRailBase::Settings &settings);
+  void write_position(int64_t steps, bool clean);
+};
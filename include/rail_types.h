@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "job.h"
+
+// Типы, не зависящие от механики: состояния, настройки стека, снимок состояния
+struct MacroRailBase
+{
+  enum State
+  {
+    IDLE,
+    HOMING,
+    HOMING_COMPLETE,
+    HOMING_RETRACT,
+    MOVING,
+    SHOOTING,
+    ERROR
+  };
+
+  struct Settings
+  {
+    int32_t step_size_um = 300; // Шаг в мкм
+    int total_photos = 3; // Количество фотографий
+    float max_speed = 0.7;  // Максимальная корость в мм/с
+    int focus_time = 500;   // Время удержания автофокуса в мс
+    int release_time = 200; // Время удержания спуска затвора в мс
+    int before_shoot_delay = 100; // Задержка перед спуском затвора в мс
+    int after_shoot_delay = 100; // Задержка после спуска затвора в мс
+    bool s_curve = true; // S-кривая (ограничение рывка) для шагов стека, иначе трапеция
+    bool continuous = false; // Съёмка на ходу: затвор по сравнению позиции, без остановок
+  };
+
+  // Этапы задания: хоуминг, подвод к началу, стек, действие после стека
+  enum JobStage : uint8_t
+  {
+    JOB_NONE,
+    JOB_HOMING,
+    JOB_POSITIONING,
+    JOB_SHOOTING,
+    JOB_FINISHING
+  };
+
+  // Задание, заранее проверенное и переведённое в шаги. Задача движения
+  // выполняет его целиком сама, без команд по сети между кадрами.
+  struct JobPlan
+  {
+    struct Segment
+    {
+      int64_t offset_um;    // Первый кадр участка от начала стека
+      int32_t step_um;
+      uint16_t first_frame; // Номер первого кадра участка в стеке
+      uint16_t frames;
+      float speed;          // мм/с
+    };
+
+    Settings settings; // Камера и режим; шаг и скорость - первого участка, кадры - всего стека
+    bool home = false;
+    bool preposition = false;
+    bool has_start = false; // Иначе стек снимается от позиции на момент запуска
+    int64_t start_steps = 0;
+    JobAfter after = JOB_AFTER_STAY;
+    int64_t park_steps = 0;
+    uint8_t segment_count = 0;
+    Segment segments[JOB_MAX_SEGMENTS];
+  };
+
+  enum JobState : uint8_t
+  {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_ABORTED
+  };
+
+  // Запись очереди: состояние и время задания, видны в /status
+  struct JobRecord
+  {
+    uint32_t id;
+    JobState state;
+    uint16_t frames;
+    uint16_t photos;      // Снято кадров
+    uint32_t queued_ms;   // hal::millis() постановки в очередь
+    uint32_t started_ms;
+    uint32_t finished_ms;
+    const char *error;    // Причина прерывания, nullptr - нет
+  };
+
+  // Снимок состояния для веб-интерфейса, публикуется задачей движения
+  struct Status
+  {
+    State state;
+    int64_t steps;        // Текущая позиция в шагах
+    int64_t target_steps; // Цель в шагах
+    int photo_count;
+    bool endstop;
+    bool referenced;         // Позиция привязана к концевику и с тех пор не терялась
+    uint32_t homing_time_ms; // Длительность последнего хоуминга, 0 - не выполнялся
+    int32_t frame_error_steps;     // Отклонение позиции последнего кадра на ходу от плановой
+    int32_t frame_error_max_steps; // Наибольшее по модулю отклонение за стек
+    bool driver_energised;
+    uint32_t driver_energised_ms;  // Суммарное время под током
+    uint32_t driver_enable_count;  // Число включений драйвера
+    JobStage job_stage;
+    const char *job_error; // Причина прерывания последнего задания, nullptr - не прерывалось
+    uint32_t job_estimate_ms; // Прогноз длительности текущего задания без хоуминга, 0 - нет прогноза
+    uint32_t job_eta_ms;      // Осталось до конца задания по прогнозу
+    uint8_t job_count;     // Записей очереди, от старой к новой
+    JobRecord jobs[JOB_QUEUE_SIZE];
+    Settings settings;
+  };
+
+  static const char *get_state_string(State s)
+  {
+    switch (s)
+    {
+    case IDLE:
+      return "IDLE";
+    case HOMING:
+      return "HOMING";
+    case HOMING_COMPLETE:
+      return "HOMING_COMPLETE";
+    case HOMING_RETRACT:
+      return "HOMING_RETRACT";
+    case MOVING:
+      return "MOVING";
+    case SHOOTING:
+      return "SHOOTING";
+    case ERROR:
+      return "ERROR";
+    default:
+      return "UNKNOWN";
+    }
+  }
+
+  static const char *get_job_stage_string(JobStage s)
+  {
+    switch (s)
+    {
+    case JOB_NONE:
+      return "none";
+    case JOB_HOMING:
+      return "homing";
+    case JOB_POSITIONING:
+      return "positioning";
+    case JOB_SHOOTING:
+      return "shooting";
+    case JOB_FINISHING:
+      return "finishing";
+    default:
+      return "unknown";
+    }
+  }
+
+  static const char *get_job_state_string(JobState s)
+  {
+    switch (s)
+    {
+    case JOB_QUEUED:
+      return "queued";
+    case JOB_RUNNING:
+      return "running";
+    case JOB_DONE:
+      return "done";
+    case JOB_ABORTED:
+      return "aborted";
+    default:
+      return "unknown";
+    }
+  }
+};
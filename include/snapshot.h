@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// Снимок состояния, публикуемый одной задачей и читаемый другими (seqlock).
+// Писатель никогда не ждёт; читатель повторяет копирование, если попал на запись.
+// T должен быть тривиально копируемым.
+template <typename T>
+class Snapshot
+{
+public:
+  void publish(const T &value)
+  {
+    uint32_t sequence = counter.load(std::memory_order_relaxed);
+    counter.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy((void *)&data, &value, sizeof(T));
+    counter.store(sequence + 2, std::memory_order_release);
+  }
+
+  T read() const
+  {
+    T copy;
+    uint32_t before, after;
+    do
+    {
+      before = counter.load(std::memory_order_acquire);
+      memcpy(&copy, (const void *)&data, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = counter.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+    return copy;
+  }
+
+  uint32_t version() const { return counter.load(std::memory_order_acquire); }
+
+private:
+  volatile T data;
+  std::atomic<uint32_t> counter{0};
+};
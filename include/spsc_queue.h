@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Ограниченная lock-free очередь "один писатель - один читатель".
+// Писатель трогает только head, читатель - только tail, поэтому блокировки не нужны.
+// Ёмкость - степень двойки, одна ячейка всегда остаётся свободной.
+template <typename T, uint32_t N>
+class SpscQueue
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "Ёмкость очереди должна быть степенью двойки");
+
+public:
+  bool push(const T &item)
+  {
+    uint32_t head = head_index.load(std::memory_order_relaxed);
+    uint32_t next = (head + 1) & (N - 1);
+    if (next == tail_index.load(std::memory_order_acquire))
+      return false; // Очередь заполнена
+    items[head] = item;
+    head_index.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &item)
+  {
+    uint32_t tail = tail_index.load(std::memory_order_relaxed);
+    if (tail == head_index.load(std::memory_order_acquire))
+      return false; // Очередь пуста
+    item = items[tail];
+    tail_index.store((tail + 1) & (N - 1), std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const
+  {
+    return tail_index.load(std::memory_order_acquire) == head_index.load(std::memory_order_acquire);
+  }
+
+private:
+  T items[N];
+  std::atomic<uint32_t> head_index{0};
+  std::atomic<uint32_t> tail_index{0};
+};
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+
+#include "motion_profile.h"
+#include "rail_config.h"
+#include "rail_types.h"
+
+#ifndef STACK_SIM_TICK_MS
+#define STACK_SIM_TICK_MS 1 // Период update() задачи движения
+#endif
+#ifndef STACK_SIM_TIMER_HZ
+#define STACK_SIM_TIMER_HZ 10000000 // Разрешение расписания шагов, как у STEP_TIMER_HZ
+#endif
+#ifndef STACK_SIM_MOVE_CACHE
+#define STACK_SIM_MOVE_CACHE 4 // Запомненных перемещений между кадрами: у задания их немного разных
+#endif
+
+// Прогноз задания: длительность по фазам и позиция в конце. Время - от запуска
+// задания (после хоуминга, если он есть) до того, как рельс готов к следующему.
+struct StackEstimate
+{
+  uint32_t total_ms = 0;
+  uint32_t positioning_ms = 0; // Подвод к началу стека
+  uint32_t runup_ms = 0;       // На ходу: отъезд назад для разгона
+  uint32_t focus_ms = 0;       // На ходу: фокусировка перед проходом
+  uint32_t moving_ms = 0;      // Перемещения между кадрами; на ходу - весь проход
+  uint32_t settle_ms = 0;      // От остановки до спуска: успокоение и фокусировка
+  uint32_t exposure_ms = 0;    // От спуска до следующего перемещения
+  uint32_t finishing_ms = 0;   // Действие после стека
+  int64_t final_steps = 0;
+  uint16_t frames = 0;         // Кадров будет снято; на ходу за пределом хода - меньше плана
+  bool homing = false;         // В задании есть хоуминг: его длительность в прогноз не входит
+};
+
+// Модель съёмки стека по событиям: те же решения, что MacroRail::update() в
+// SHOOTING, но без перебора каждого периода. Длительность перемещения берётся
+// из того же StepSchedule, что у генератора шагов, и округляется до периода
+// update(), в котором остановка будет замечена. Пределы движения, скорость
+// прохода и позиции кадров MacroRail берёт отсюда же, поэтому модель не
+// расходится с рельсом. Хоуминг не моделируется: он зависит от неизвестного
+// положения каретки. Расписание занимает пару килобайт - экземпляр статический
+// или член класса, не на стеке задачи.
+template <typename Config>
+class StackSimulator
+{
+public:
+  typedef RailMechanics<Config> Mechanics;
+  typedef MacroRailBase::Settings Settings;
+  typedef MacroRailBase::JobPlan JobPlan;
+
+  // Профиль перемещения между кадрами со скоростью участка
+  static MotionLimits stack_limits(float speed, bool s_curve)
+  {
+    MotionLimits limits;
+    limits.max_speed = speed * Mechanics::steps_per_mm;
+    limits.acceleration = Config::default_accel * Mechanics::steps_per_mm;
+    limits.jerk = s_curve ? Config::default_jerk * Mechanics::steps_per_mm : 0;
+    return limits;
+  }
+
+  static MotionLimits rapid_limits()
+  {
+    MotionLimits limits;
+    limits.max_speed = Config::rapid_speed * Mechanics::steps_per_mm;
+    limits.acceleration = Config::rapid_accel * Mechanics::steps_per_mm;
+    limits.jerk = Config::default_jerk * Mechanics::steps_per_mm;
+    return limits;
+  }
+
+  // Скорость прохода на ходу: кадр не может идти чаще, чем успевает затвор и вспышка
+  static float flyby_speed(const Settings &settings)
+  {
+    int cycle_ms = settings.release_time + settings.after_shoot_delay;
+    float speed = settings.max_speed;
+    if (cycle_ms > 0 && speed > (float)settings.step_size_um / cycle_ms)
+      speed = (float)settings.step_size_um / cycle_ms;
+    return speed;
+  }
+
+  // Трапеция: длина разгона известна заранее и укладывается в отъезд назад
+  static MotionLimits flyby_limits(float speed)
+  {
+    return stack_limits(speed, false);
+  }
+
+  // Путь разгона прохода в шагах с запасом
+  static int64_t flyby_ramp(const MotionLimits &limits)
+  {
+    return (int64_t)(limits.max_speed * limits.max_speed / (2 * limits.acceleration)) + 16;
+  }
+
+  // Участок, которому принадлежит кадр; за последним кадром - последний участок
+  static const JobPlan::Segment &segment_of(const JobPlan &plan, int frame)
+  {
+    uint8_t i = 0;
+    while (i + 1 < plan.segment_count && frame >= plan.segments[i + 1].first_frame)
+      i++;
+    return plan.segments[i];
+  }
+
+  // Цель кадра считается от начала стека целиком, а не от предыдущей позиции,
+  // поэтому дробная часть шага не накапливается на длинных стеках
+  static int64_t frame_position(const JobPlan &plan, int64_t start, int index)
+  {
+    const JobPlan::Segment &segment = segment_of(plan, index);
+    int64_t offset_um = segment.offset_um + (int64_t)(index - segment.first_frame) * segment.step_um;
+    return std::clamp(start + Mechanics::um_to_steps(offset_um), (int64_t)0, Mechanics::max_travel_steps);
+  }
+
+  // from_steps - позиция рельса при запуске задания; для задания с хоуминга - 0
+  StackEstimate estimate(const JobPlan &plan, int64_t from_steps)
+  {
+    const Settings &settings = plan.settings;
+    StackEstimate result;
+    result.homing = plan.home || plan.after == JOB_AFTER_HOME;
+    cache_count = 0; // Скорости и опережение фокуса - из настроек этого задания
+    cache_next = 0;
+
+    // Время в периодах update() от запуска; действие в периоде t рельс
+    // проверяет в следующем
+    uint32_t now = 0;
+    int64_t position = from_steps;
+    if (plan.has_start && !settings.continuous)
+    {
+      int64_t target = std::clamp(plan.start_steps, (int64_t)0, Mechanics::max_travel_steps);
+      now = move_ticks(target - position, rapid_limits());
+      position = target;
+    }
+    else
+    {
+      now = 1;
+    }
+    result.positioning_ms = now * STACK_SIM_TICK_MS;
+
+    int64_t start = plan.has_start ? plan.start_steps : position;
+    if (settings.continuous)
+      now = simulate_flyby(plan, start, now, position, result);
+    else
+      now = simulate_stepped(plan, start, now, position, result);
+
+    // Действие после стека запускается в том же update(), что закончил съёмку
+    uint32_t finished = now + 1;
+    if (plan.after == JOB_AFTER_RETURN || plan.after == JOB_AFTER_PARK)
+    {
+      int64_t target = plan.after == JOB_AFTER_RETURN ? start : plan.park_steps;
+      target = std::clamp(target, (int64_t)0, Mechanics::max_travel_steps);
+      finished = now + move_ticks(target - position, rapid_limits());
+      position = target;
+    }
+    else if (plan.after == JOB_AFTER_HOME)
+    {
+      position = 0;
+    }
+    result.finishing_ms = (finished - now) * STACK_SIM_TICK_MS;
+    result.total_ms = finished * STACK_SIM_TICK_MS;
+    result.final_steps = position;
+    return result;
+  }
+
+private:
+  StepSchedule schedule;
+
+  // Перемещение стека: период остановки и период включения фокуса (0 - на остановке)
+  struct MoveTiming
+  {
+    uint32_t steps;
+    float speed;
+    uint32_t stop_ticks;
+    uint32_t focus_ticks;
+  };
+
+  MoveTiming cache[STACK_SIM_MOVE_CACHE];
+  uint8_t cache_count = 0;
+  uint8_t cache_next = 0;
+
+  static constexpr uint64_t timer_ticks_per_tick()
+  {
+    return (uint64_t)STACK_SIM_TIMER_HZ / 1000 * STACK_SIM_TICK_MS;
+  }
+
+  // Период, в котором шаг с меткой timer_ticks от начала перемещения уже выдан
+  static uint32_t tick_of(uint64_t timer_ticks)
+  {
+    return (uint32_t)((timer_ticks + timer_ticks_per_tick() - 1) / timer_ticks_per_tick());
+  }
+
+  // Периодов от команды перемещения до update(), заметившего остановку
+  uint32_t move_ticks(int64_t distance, const MotionLimits &limits)
+  {
+    uint32_t steps = (uint32_t)(distance < 0 ? -distance : distance);
+    if (steps == 0)
+      return 1;
+    schedule.plan(steps, limits, STACK_SIM_TIMER_HZ);
+    return std::max(tick_of(schedule.ticks_until(steps)), (uint32_t)1);
+  }
+
+  // Фокус на торможении включается по той же оценке, что focus_lead_reached():
+  // расписание перебирается по периодам до первого, где 2 * путь / скорость
+  // укладывается в опережение. Одинаковые перемещения считаются один раз.
+  const MoveTiming &stepped_move(uint32_t steps, float speed, bool s_curve, int32_t lead_ms)
+  {
+    for (uint8_t i = 0; i < cache_count; i++)
+      if (cache[i].steps == steps && cache[i].speed == speed)
+        return cache[i];
+
+    MoveTiming &timing = cache[cache_next];
+    cache_next = (cache_next + 1) % STACK_SIM_MOVE_CACHE;
+    if (cache_count < STACK_SIM_MOVE_CACHE)
+      cache_count++;
+    timing.steps = steps;
+    timing.speed = speed;
+    timing.focus_ticks = 0;
+    timing.stop_ticks = move_ticks(steps, stack_limits(speed, s_curve));
+    if (steps == 0 || lead_ms <= 0)
+      return timing;
+
+    uint64_t step_time = 0;
+    uint32_t done = 0;
+    uint32_t interval = schedule.next_interval();
+    for (uint32_t tick = 1; tick < timing.stop_ticks && interval; tick++)
+    {
+      uint64_t tick_time = tick * timer_ticks_per_tick();
+      while (interval && step_time + interval <= tick_time)
+      {
+        step_time += interval;
+        done++;
+        interval = schedule.next_interval();
+      }
+      if (!interval)
+        break;
+      float stop_ms = 2000.0f * (steps - done) / ((float)STACK_SIM_TIMER_HZ / interval);
+      if (stop_ms <= lead_ms)
+      {
+        timing.focus_ticks = tick;
+        break;
+      }
+    }
+    return timing;
+  }
+
+  // Стек с остановками: перемещение, успокоение и фокус, спуск, экспозиция.
+  // Возвращает период, в котором снят последний кадр.
+  uint32_t simulate_stepped(const JobPlan &plan, int64_t start, uint32_t begin, int64_t &position,
+                            StackEstimate &result)
+  {
+    const Settings &settings = plan.settings;
+    int32_t lead_ms = settings.focus_time - settings.before_shoot_delay;
+    uint32_t before = settings.before_shoot_delay / STACK_SIM_TICK_MS;
+    uint32_t focus = settings.focus_time / STACK_SIM_TICK_MS;
+    uint32_t release = settings.release_time / STACK_SIM_TICK_MS;
+    uint32_t after = settings.after_shoot_delay / STACK_SIM_TICK_MS;
+
+    uint32_t move_start = begin;
+    for (int i = 0; i < settings.total_photos; i++)
+    {
+      // Первый кадр - с места: остановка замечена в следующем периоде
+      uint32_t stopped = move_start + 1;
+      uint32_t focused = stopped;
+      if (i > 0)
+      {
+        int64_t target = frame_position(plan, start, i);
+        int64_t distance = target - position;
+        const MoveTiming &timing = stepped_move((uint32_t)(distance < 0 ? -distance : distance),
+                                                segment_of(plan, i).speed, settings.s_curve, lead_ms);
+        stopped = move_start + timing.stop_ticks;
+        focused = timing.focus_ticks ? move_start + timing.focus_ticks : stopped;
+        position = target;
+      }
+      uint32_t fired = std::max({stopped + 1, stopped + before, focused + focus});
+      uint32_t next = fired + std::max({(uint32_t)1, release, after});
+      result.moving_ms += (stopped - move_start) * STACK_SIM_TICK_MS;
+      result.settle_ms += (fired - stopped) * STACK_SIM_TICK_MS;
+      result.exposure_ms += (next - fired) * STACK_SIM_TICK_MS;
+      result.frames++;
+      move_start = next;
+    }
+    return move_start;
+  }
+
+  // Первый шаг прохода не раньше min_step, выданный позже after_ticks; 0 - проход кончился раньше
+  uint32_t first_step_after(uint32_t min_step, uint64_t after_ticks, uint32_t pass_steps) const
+  {
+    if (min_step > pass_steps || schedule.ticks_until(pass_steps) <= after_ticks)
+      return 0;
+    uint32_t low = min_step, high = pass_steps;
+    while (low < high)
+    {
+      uint32_t middle = low + (high - low) / 2;
+      if (schedule.ticks_until(middle) > after_ticks)
+        high = middle;
+      else
+        low = middle + 1;
+    }
+    return low;
+  }
+
+  // Съёмка на ходу: отъезд для разгона, фокусировка, проход; кадр - на шаге,
+  // пересёкшем его позицию, следующий взводится после отпускания затвора.
+  // Возвращает период, в котором проход закончен.
+  uint32_t simulate_flyby(const JobPlan &plan, int64_t start, uint32_t begin, int64_t &position,
+                          StackEstimate &result)
+  {
+    const Settings &settings = plan.settings;
+    MotionLimits limits = flyby_limits(flyby_speed(settings));
+    int64_t ramp = flyby_ramp(limits);
+    int64_t runup = std::max(start - ramp, (int64_t)0);
+
+    uint32_t focus_start = begin + move_ticks(runup - position, rapid_limits());
+    uint32_t pass_start = focus_start + settings.focus_time / STACK_SIM_TICK_MS + 1;
+    result.runup_ms = (focus_start - begin) * STACK_SIM_TICK_MS;
+    result.focus_ms = (pass_start - focus_start) * STACK_SIM_TICK_MS;
+
+    int64_t pass_end = std::clamp(frame_position(plan, start, settings.total_photos - 1) + ramp,
+                                  (int64_t)0, Mechanics::max_travel_steps);
+    int64_t pass = pass_end - runup;
+    uint32_t pass_steps = (uint32_t)(pass < 0 ? -pass : pass);
+    uint32_t end = pass_start + move_ticks(pass, limits); // Тот же план остаётся в schedule
+
+    uint32_t armed = pass_start;
+    uint32_t released = pass_start;
+    for (int i = 0; i < settings.total_photos && pass_steps; i++)
+    {
+      int64_t offset = frame_position(plan, start, i) - runup;
+      uint32_t step = first_step_after((uint32_t)std::max(offset, (int64_t)1),
+                                       (uint64_t)(armed - pass_start) * timer_ticks_per_tick(), pass_steps);
+      if (!step)
+        break;
+      uint32_t fired = pass_start + tick_of(schedule.ticks_until(step));
+      released = fired + settings.release_time / STACK_SIM_TICK_MS + 1;
+      armed = released;
+      result.frames++;
+    }
+
+    uint32_t done = std::max(end, released);
+    result.moving_ms = (done - pass_start) * STACK_SIM_TICK_MS;
+    position = pass_end;
+    return done;
+  }
+};
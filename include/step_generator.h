@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "motion_profile.h"
+
+// Общий интерфейс генератора шагов. Повторяет API AccelStepper, чтобы MacroRail
+// не зависел от бэкенда: аппаратный таймер, AccelStepper или симуляция на хосте.
+class StepGenerator
+{
+public:
+  // Обработчик сравнения позиции; у бэкендов на таймере вызывается из прерывания
+  typedef void (*CompareCallback)(void *context, int64_t position);
+
+  virtual ~StepGenerator() {}
+
+  virtual void begin() {}
+  virtual void set_limits(const MotionLimits &limits) = 0;
+  virtual void move_to(int64_t absolute) = 0;
+  void move(int64_t relative) { move_to(current_position() + relative); }
+  virtual void stop() = 0; // Немедленная остановка, цель = текущая позиция
+  virtual void run() {}    // Опрос, нужен только программному бэкенду
+  virtual void halt_from_isr() = 0; // Остановка из прерывания (концевик)
+
+  virtual int64_t current_position() const = 0;
+  virtual int64_t target_position() const = 0;
+  virtual void set_current_position(int64_t position) = 0; // Останавливает движение, как в AccelStepper
+  virtual float speed() const = 0;                      // Текущая скорость в шаг/с со знаком
+  virtual bool needs_polling() const { return false; }
+
+  int64_t distance_to_go() const { return target_position() - current_position(); }
+
+  // Однократное сравнение: callback вызывается на шаге, которым генератор достиг
+  // или пересёк position в текущем направлении движения
+  void set_position_compare(int64_t position, CompareCallback callback, void *context)
+  {
+    compare_armed = false;
+    compare_position = position;
+    compare_callback = callback;
+    compare_context = context;
+    compare_armed = true;
+  }
+
+  void clear_position_compare() { compare_armed = false; }
+
+protected:
+  volatile bool compare_armed = false;
+  volatile int64_t compare_position = 0;
+  CompareCallback compare_callback = nullptr;
+  void *compare_context = nullptr;
+
+  STEP_ISR_ATTR void check_compare(int64_t position, int8_t direction)
+  {
+    if (!compare_armed)
+      return;
+    if (direction > 0 ? position < compare_position : position > compare_position)
+      return;
+    compare_armed = false;
+    compare_callback(compare_context, position);
+  }
+};
+
+// Базовая часть бэкендов, работающих по StepSchedule (таймер ESP32 и симуляция)
+class ScheduledStepGenerator : public StepGenerator
+{
+public:
+  explicit ScheduledStepGenerator(uint32_t timer_hz) : timer_hz(timer_hz) {}
+
+  void set_limits(const MotionLimits &new_limits) override { limits = new_limits; }
+  void move_to(int64_t absolute) override;
+  void stop() override;
+  STEP_ISR_ATTR void halt_from_isr() override
+  {
+    stop_timer_from_isr();
+    running = false;
+    current_interval = 0;
+    target = position;
+  }
+
+  int64_t current_position() const override;
+  int64_t target_position() const override { return target; }
+  void set_current_position(int64_t new_position) override;
+  float speed() const override;
+
+  bool is_running() const { return running; }
+  const StepSchedule &get_schedule() const { return schedule; }
+
+protected:
+  const uint32_t timer_hz;
+  MotionLimits limits;
+
+  StepSchedule schedule;
+  volatile int64_t position = 0; // 64-битная позиция меняется в прерывании не атомарно
+  volatile int64_t target = 0;
+  volatile int8_t direction = 1;
+  volatile uint32_t current_interval = 0;
+  volatile bool running = false;
+
+  // Обработка одного срабатывания таймера: шаг и интервал до следующего (0 - конец)
+  STEP_ISR_ATTR uint32_t on_step()
+  {
+    position += direction;
+    check_compare(position, direction);
+    uint32_t next = schedule.next_interval();
+    current_interval = next;
+    if (next == 0)
+      running = false;
+    return next;
+  }
+
+  virtual void set_direction_pin(bool forward) = 0;
+  virtual void start_timer(uint32_t first_interval) = 0;
+  virtual void stop_timer() = 0;
+  virtual void stop_timer_from_isr() = 0;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <AccelStepper.h>
+
+#include "step_generator.h"
+#include "step_trace.h"
+
+// Резервный бэкенд на AccelStepper: шаги выдаются только при опросе run()
+class AccelStepperGenerator : public StepGenerator
+{
+public:
+  AccelStepperGenerator(uint8_t step_pin, uint8_t dir_pin, bool invert_dir)
+      : stepper(AccelStepper::DRIVER, step_pin, dir_pin)
+  {
+    stepper.setPinsInverted(invert_dir, false, false); // DIR, STEP, ENABLE
+    stepper.setEnablePin(-1);                          // Управление ENABLE вручную
+  }
+
+  // AccelStepper умеет только трапецию: рывок игнорируется
+  void set_limits(const MotionLimits &limits) override
+  {
+    stepper.setMaxSpeed(limits.max_speed);
+    stepper.setAcceleration(limits.acceleration);
+  }
+  void move_to(int64_t absolute) override
+  {
+    TRACE_MOVE_AT(StepTrace::now(), absolute > stepper.currentPosition());
+    stepper.moveTo((long)absolute);
+  }
+  void stop() override { stepper.setCurrentPosition(stepper.currentPosition()); }
+  void run() override
+  {
+    // AccelStepper нельзя трогать из прерывания: остановка откладывается до опроса
+    if (halt_requested)
+    {
+      halt_requested = false;
+      stop();
+      return;
+    }
+#if STEP_TRACE
+    float scheduled_speed = stepper.speed(); // Интервал до шага, рассчитанный AccelStepper на прошлом шаге
+#endif
+    stepper.run();
+
+    // Сравнение позиции - тоже по опросу: run() выдаёт не больше одного шага
+    long position = stepper.currentPosition();
+    if (position != last_position)
+    {
+#if STEP_TRACE
+      TRACE_STEP_AT(StepTrace::now(), scheduled_speed != 0 ? (uint32_t)(1000000.0f / fabsf(scheduled_speed)) : 0);
+#endif
+      check_compare(position, position > last_position ? 1 : -1);
+      last_position = position;
+    }
+  }
+
+  void halt_from_isr() override { halt_requested = true; }
+
+  int64_t current_position() const override { return stepper.currentPosition(); }
+  int64_t target_position() const override { return stepper.targetPosition(); }
+  void set_current_position(int64_t position) override
+  {
+    stepper.setCurrentPosition((long)position);
+    last_position = (long)position;
+  }
+  float speed() const override { return stepper.speed(); }
+  bool needs_polling() const override { return true; }
+
+private:
+  mutable AccelStepper stepper;
+  volatile bool halt_requested = false;
+  long last_position = 0;
+};
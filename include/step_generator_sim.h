@@ -0,0 +1,50 @@
+#pragma once
+
+#include "step_generator.h"
+
+// Симуляция генератора шагов для хоста: то же расписание, что и у аппаратного
+// таймера, но время виртуальное. Каждый шаг передаётся в обработчик с точной
+// меткой времени в тиках, что позволяет проверять тайминг импульсов на Linux.
+class SimStepGenerator : public ScheduledStepGenerator
+{
+public:
+  typedef void (*StepCallback)(void *context, uint64_t tick, int64_t position);
+
+  explicit SimStepGenerator(uint32_t timer_hz = 10000000) : ScheduledStepGenerator(timer_hz) {}
+
+  void set_step_callback(StepCallback callback, void *context)
+  {
+    step_callback = callback;
+    step_context = context;
+  }
+
+  // Продвинуть виртуальное время до now, выдав все шаги, срок которых наступил
+  void advance_to(uint64_t now)
+  {
+    while (running && next_tick <= now)
+    {
+      uint64_t tick = next_tick;
+      uint32_t next = on_step();
+      if (step_callback)
+        step_callback(step_context, tick, position);
+      next_tick += next;
+    }
+    now_tick = now;
+  }
+
+  uint64_t now() const { return now_tick; }
+  uint64_t next_step_tick() const { return next_tick; }
+  int8_t step_direction() const { return direction; }
+
+protected:
+  void set_direction_pin(bool) override {}
+  void start_timer(uint32_t first_interval) override { next_tick = now_tick + first_interval; }
+  void stop_timer() override {}
+  void stop_timer_from_isr() override {}
+
+private:
+  uint64_t now_tick = 0;
+  uint64_t next_tick = 0;
+  StepCallback step_callback = nullptr;
+  void *step_context = nullptr;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#if defined(ESP32)
+
+#include <driver/timer.h>
+#include <freertos/FreeRTOS.h>
+
+#include "step_generator.h"
+
+#define STEP_TIMER_DIVIDER 8                           // 80 МГц APB / 8 = 10 МГц
+#define STEP_TIMER_HZ (80000000 / STEP_TIMER_DIVIDER)  // Разрешение расписания - 0.1 мкс
+#define STEP_PULSE_US 2                                // Длительность импульса STEP (DRV8825 - от 1.9 мкс)
+
+// Генератор шагов на аппаратном таймере ESP32: импульсы выдаёт прерывание по
+// расписанию StepSchedule, поэтому loop(), веб-сервер и Serial не влияют на шаги.
+class TimerStepGenerator : public ScheduledStepGenerator
+{
+public:
+  TimerStepGenerator(uint8_t step_pin, uint8_t dir_pin, bool invert_dir,
+                     timer_group_t group = TIMER_GROUP_1, timer_idx_t index = TIMER_0);
+
+  void begin() override;
+
+protected:
+  void set_direction_pin(bool forward) override;
+  void start_timer(uint32_t first_interval) override;
+  void stop_timer() override;
+  void stop_timer_from_isr() override;
+
+private:
+  const uint8_t step_pin;
+  const uint8_t dir_pin;
+  const bool invert_dir;
+  const timer_group_t group;
+  const timer_idx_t index;
+
+  uint32_t step_mask;
+  bool step_high_bank; // GPIO32..39 лежат во втором банке регистров
+  uint32_t pulse_cycles = 0;
+  portMUX_TYPE timer_mux = portMUX_INITIALIZER_UNLOCKED;
+
+  static bool on_timer(void *arg);
+};
+
+#endif
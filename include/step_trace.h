@@ -0,0 +1,113 @@
+#pragma once
+
+#include "hal.h"
+#if defined(ESP32)
+#include <hal/cpu_hal.h>
+#endif
+
+#include "motion_profile.h"
+
+// Трассировка шагов для разбора неравномерного шага и рывков:
+// 1 - запись включается в сборку, 0 - вызовы вырезаются вместе с аргументами
+#ifndef STEP_TRACE
+#define STEP_TRACE 0
+#endif
+
+#if STEP_TRACE
+#define TRACE_STEP_AT(cycles, scheduled) step_trace.step(cycles, scheduled)
+#define TRACE_MOVE_AT(cycles, forward) step_trace.move(cycles, forward)
+#define TRACE_EVENT(type, value) step_trace.event(type, value)
+#else
+#define TRACE_STEP_AT(cycles, scheduled) do {} while (0)
+#define TRACE_MOVE_AT(cycles, forward) do {} while (0)
+#define TRACE_EVENT(type, value) do {} while (0)
+#endif
+
+#define STEP_TRACE_RECORDS 4096 // Записей в кольце, степень двойки: 32 КБ
+#define STEP_TRACE_MAGIC 0x43525452 // "RTRC" в little-endian
+#define STEP_TRACE_VERSION 1
+
+// События трассы; номера - часть формата выгрузки (tools/trace_decode.py)
+enum StepTraceEvent : uint8_t
+{
+  TRACE_STEP,        // Импульс STEP: error - отклонение интервала от расписания
+  TRACE_MOVE,        // Запуск движения, value - 1 вперёд, 0 назад
+  TRACE_STATE,       // Смена MacroRail::State, value - новое состояние
+  TRACE_SHOT_STAGE,  // Смена shooting_stage (пошаговая съёмка)
+  TRACE_FLYBY_STAGE, // Смена этапа съёмки на ходу
+  TRACE_GAP          // Запись была приостановлена: интервал до следующего шага не измерен
+};
+
+// Запись - 8 байт. Время - счётчик тактов ядра движения: все события
+// пишутся на ядре 1 (прерывание таймера и задача движения), поэтому
+// разности меток корректны, пока между записями меньше 2^32 тактов.
+struct StepTraceRecord
+{
+  uint32_t cycles;
+  int16_t error; // TRACE_STEP: фактический интервал минус заданный, в тиках генератора, с насыщением
+  uint8_t type;
+  uint8_t value;
+};
+
+// Заголовок выгрузки, за ним - count записей от старой к новой
+struct StepTraceHeader
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t record_size;
+  uint16_t reserved;
+  uint32_t cpu_hz;   // Частота счётчика тактов
+  uint32_t timer_hz; // Единица расписания шагов и поля error
+  uint32_t count;
+  uint32_t lost;     // Записей, затёртых по кругу с начала трассы
+};
+
+// Кольцо в статической внутренней RAM: прерывание шагов работает из IRAM и
+// во время записи во flash, когда PSRAM через кэш недоступна. При заполнении
+// затираются старые записи. Запись и чтение разделены спинлоком: на время
+// выгрузки трасса приостанавливается.
+class StepTrace
+{
+public:
+  // timer_hz - частота расписания генератора (у AccelStepper - микросекунды)
+  void begin(uint32_t timer_hz);
+
+  void start(); // Очистить и начать запись
+  void stop();
+  bool active() const { return armed; }
+
+  static inline uint32_t now()
+  {
+#if defined(ESP32)
+    return cpu_hal_get_cycle_count();
+#else
+    return hal::micros();
+#endif
+  }
+
+  // Шаг на метке cycles; scheduled - интервал до него по расписанию, в тиках генератора
+  STEP_ISR_ATTR void step(uint32_t cycles, uint32_t scheduled);
+  STEP_ISR_ATTR void move(uint32_t cycles, bool forward);
+  void event(StepTraceEvent type, uint8_t value);
+
+  // Выгрузка: pause() замораживает кольцо, read() отдаёт записи от старой
+  // к новой, resume() продолжает запись, если она шла до pause()
+  bool pause();
+  StepTraceHeader header() const;
+  size_t read(size_t first, StepTraceRecord *out, size_t count) const;
+  void resume(bool was_active);
+
+private:
+  StepTraceRecord records[STEP_TRACE_RECORDS];
+  uint32_t written = 0; // Всего записей с start(), индекс - по модулю размера кольца
+  uint32_t last_cycles = 0;
+  uint32_t cpu_hz = 0;
+  uint32_t timer_hz = 1;
+  uint32_t cycles_per_tick = 1;
+  volatile bool armed = false;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+  STEP_ISR_ATTR void append(uint32_t cycles, int16_t error, uint8_t type, uint8_t value);
+};
+
+extern StepTrace step_trace;
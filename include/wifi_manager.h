@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define WIFI_FAST_TIMEOUT_MS 3000     // Подключение по кэшу: BSSID, канал и IP известны
+#define WIFI_CONNECT_TIMEOUT_MS 10000 // Подключение к точке, выбранной сканированием
+#define WIFI_RETRY_MS 5000            // Пауза перед повторным сканированием
+#define WIFI_LOST_MS 30000            // Обрыв дольше этого - точка могла смениться, сканируем заново
+
+// Список сетей Wi-Fi для подключения (SSID и пароль)
+struct WifiCredentials
+{
+  const char *ssid;
+  const char *password;
+};
+
+struct WifiReport
+{
+  bool connected;
+  bool fast;         // Последнее подключение - по кэшу, без сканирования и DHCP
+  int8_t rssi;
+  uint32_t ready_ms; // От загрузки до первого IP, 0 - ещё не подключались
+  uint32_t connects; // Подключений с загрузки, включая восстановление после обрыва
+};
+
+// Подключение к Wi-Fi в фоновой задаче: setup() и хоуминг его не ждут.
+// Сначала - быстрое подключение по кэшу в NVS (BSSID, канал, IP прошлого
+// успешного подключения), без сканирования и DHCP. Если не вышло - одно
+// сканирование и подключение к самой сильной из известных сетей; кэш
+// перезаписывается, только если что-то изменилось.
+class WifiManager
+{
+public:
+  // networks заканчивается маркером {nullptr, nullptr}
+  explicit WifiManager(const WifiCredentials *networks) : networks(networks) {}
+
+  // Переводит Wi-Fi в режим станции сразу (после этого можно запускать
+  // HTTP-сервер), подключение продолжается в задаче на заданном ядре
+  void begin(uint8_t core, uint8_t priority);
+
+  WifiReport report() const;
+
+private:
+  // Кэш последнего подключения в NVS
+  struct Cache
+  {
+    uint8_t version;
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+  };
+
+  const WifiCredentials *networks;
+  volatile bool fast = false;
+  volatile uint32_t ready_ms = 0;
+  volatile uint32_t connects = 0;
+
+  static void task(void *arg);
+  void run();
+  bool connect_cached();
+  bool connect_scanned();
+  bool wait_connected(uint32_t timeout_ms);
+  void connected(bool cached);
+  const WifiCredentials *find(const char *ssid) const;
+};
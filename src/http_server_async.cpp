@@ -0,0 +1,293 @@
+#if defined(ESP32)
+
+#include "http_server_async.h"
+
+#include <ctype.h>
+#include <lwip/sockets.h>
+#include <stdlib.h>
+
+#define HTTP_QUERY_MAX 256 // Строка запроса /start с полным набором параметров - около 150 байт
+
+namespace
+{
+  // Есть ли место в буфере отправки сокета - без ожидания
+  bool socket_writable(int fd)
+  {
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    struct timeval zero = {0, 0};
+    return select(fd + 1, nullptr, &set, nullptr, &zero) > 0;
+  }
+
+  // Раскодирование %XX и '+' на месте, как это делает WebServer::arg()
+  void url_decode(char *text)
+  {
+    char *out = text;
+    for (char *in = text; *in; in++)
+    {
+      if (*in == '+')
+      {
+        *out++ = ' ';
+      }
+      else if (*in == '%' && isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2]))
+      {
+        char hex[3] = {in[1], in[2], 0};
+        *out++ = (char)strtol(hex, nullptr, 16);
+        in += 2;
+      }
+      else
+      {
+        *out++ = *in;
+      }
+    }
+    *out = 0;
+  }
+
+  const char *status_line(int code)
+  {
+    switch (code)
+    {
+    case 200:
+      return HTTPD_200;
+    case 304:
+      return "304 Not Modified";
+    case 400:
+      return HTTPD_400;
+    case 404:
+      return HTTPD_404;
+    case 414:
+      return "414 URI Too Long";
+    case 503:
+      return "503 Service Unavailable";
+    default:
+      return HTTPD_500;
+    }
+  }
+
+  class IdfRequest : public HttpRequest
+  {
+  public:
+    explicit IdfRequest(httpd_req_t *req) : req(req)
+    {
+      esp_err_t result = httpd_req_get_url_query_str(req, query, sizeof(query));
+      has_query = result == ESP_OK;
+      query_truncated = result == ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+
+    // Обрезанная строка запроса - не повод выполнять команду без параметров
+    bool query_too_long() const { return query_truncated; }
+
+    bool arg(const char *name, char *value, size_t size) override
+    {
+      if (!has_query || httpd_query_key_value(query, name, value, size) != ESP_OK)
+        return false;
+      url_decode(value);
+      return true;
+    }
+
+    bool header(const char *name, char *value, size_t size) override
+    {
+      return httpd_req_get_hdr_value_str(req, name, value, size) == ESP_OK;
+    }
+
+    int body(char *buffer, size_t size) override
+    {
+      if (req->content_len == 0 || req->content_len >= size)
+        return -1;
+      size_t received = 0;
+      int timeouts = 0;
+      while (received < req->content_len)
+      {
+        int chunk = httpd_req_recv(req, buffer + received, req->content_len - received);
+        if (chunk == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < 3)
+          continue; // Тело может прийти позже заголовков; зависший клиент задачу не держит
+        if (chunk <= 0)
+          return -1;
+        received += chunk;
+      }
+      buffer[received] = 0;
+      return received;
+    }
+
+    void send_header(const char *name, const char *value) override
+    {
+      httpd_resp_set_hdr(req, name, value);
+    }
+
+    void send(int code, const char *content_type, const char *content, size_t length) override
+    {
+      httpd_resp_set_status(req, status_line(code));
+      httpd_resp_set_type(req, content_type);
+      httpd_resp_send(req, content, length);
+    }
+
+    void begin_stream(int code, const char *content_type) override
+    {
+      httpd_resp_set_status(req, status_line(code));
+      httpd_resp_set_type(req, content_type);
+    }
+
+    bool send_chunk(const char *data, size_t length) override
+    {
+      return httpd_resp_send_chunk(req, data, length) == ESP_OK;
+    }
+
+    void end_stream() override { httpd_resp_send_chunk(req, nullptr, 0); }
+
+  private:
+    httpd_req_t *req;
+    char query[HTTP_QUERY_MAX];
+    bool has_query;
+    bool query_truncated;
+  };
+}
+
+bool AsyncHttpServer::begin(const HttpRoute *routes, size_t count)
+{
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = port;
+  config.core_id = core;
+  config.task_priority = priority;
+  config.stack_size = 8192;
+  config.max_open_sockets = max_clients; // Не больше CONFIG_LWIP_MAX_SOCKETS - 3
+  config.max_uri_handlers = count + 1; // Запас под канал WebSocket
+  config.lru_purge_enable = true; // Новый клиент вытесняет самое давнее простаивающее соединение
+  config.global_user_ctx = this;
+  config.global_user_ctx_free_fn = [](void *) {}; // Сервер - не из кучи: httpd_stop() не должен его освобождать
+
+  if (httpd_start(&handle, &config) != ESP_OK)
+    return false;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    httpd_uri_t uri = {};
+    uri.uri = routes[i].uri;
+    uri.method = routes[i].post ? HTTP_POST : HTTP_GET;
+    uri.handler = dispatch;
+    uri.user_ctx = (void *)&routes[i];
+    httpd_register_uri_handler(handle, &uri);
+  }
+  return true;
+}
+
+esp_err_t AsyncHttpServer::dispatch(httpd_req_t *req)
+{
+  const HttpRoute *route = static_cast<const HttpRoute *>(req->user_ctx);
+  AsyncHttpServer *self = static_cast<AsyncHttpServer *>(httpd_get_global_user_ctx(req->handle));
+  uint32_t start = CycleClock::now();
+  IdfRequest idf_request(req);
+  HttpRequest &request = idf_request;
+  if (idf_request.query_too_long())
+    request.send(414, "text/plain", "Query too long");
+  else
+    route->handler(request);
+  self->handler_histogram.add_us(CycleClock::elapsed_us(start));
+  return ESP_OK;
+}
+
+bool AsyncHttpServer::add_websocket(const char *uri_path)
+{
+#if CONFIG_HTTPD_WS_SUPPORT
+  httpd_uri_t uri = {};
+  uri.uri = uri_path;
+  uri.method = HTTP_GET;
+  uri.handler = on_websocket;
+  uri.user_ctx = this;
+  uri.is_websocket = true;
+  return httpd_register_uri_handler(handle, &uri) == ESP_OK;
+#else
+  return false;
+#endif
+}
+
+bool AsyncHttpServer::broadcast(const char *text, size_t length)
+{
+#if CONFIG_HTTPD_WS_SUPPORT
+  if (length > sizeof(frame) || frame_pending.exchange(true))
+    return false;
+  memcpy(frame, text, length);
+  frame_length = length;
+  if (httpd_queue_work(handle, send_frame, this) != ESP_OK)
+  {
+    frame_pending = false;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+esp_err_t AsyncHttpServer::on_websocket(httpd_req_t *req)
+{
+#if CONFIG_HTTPD_WS_SUPPORT
+  AsyncHttpServer *self = static_cast<AsyncHttpServer *>(req->user_ctx);
+  if (req->method == HTTP_GET)
+  {
+    // Рукопожатие: сокет становится получателем рассылки. Номер сокета мог
+    // остаться в списке от закрытого клиента - тогда он просто переиспользуется.
+    int fd = httpd_req_to_sockfd(req);
+    bool known = false;
+    for (uint8_t i = 0; i < self->ws_count; i++)
+      known |= self->ws_clients[i] == fd;
+    if (!known)
+    {
+      if (self->ws_count == HTTP_WS_CLIENTS_MAX)
+        return ESP_FAIL;
+      self->ws_clients[self->ws_count++] = fd;
+      // Запасная граница: отправка кадра клиенту не ждёт дольше этого
+      struct timeval timeout = {0, HTTP_WS_SEND_TIMEOUT_MS * 1000};
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    self->new_clients = true;
+    return ESP_OK;
+  }
+
+  // Канал односторонний: входящие кадры читаются и отбрасываются
+  httpd_ws_frame_t incoming = {};
+  uint8_t buffer[64];
+  if (httpd_ws_recv_frame(req, &incoming, 0) != ESP_OK || incoming.len > sizeof(buffer))
+    return ESP_FAIL;
+  incoming.payload = buffer;
+  return httpd_ws_recv_frame(req, &incoming, sizeof(buffer));
+#else
+  return ESP_FAIL;
+#endif
+}
+
+void AsyncHttpServer::send_frame(void *arg)
+{
+#if CONFIG_HTTPD_WS_SUPPORT
+  AsyncHttpServer *self = static_cast<AsyncHttpServer *>(arg);
+  httpd_ws_frame_t out = {};
+  out.type = HTTPD_WS_TYPE_TEXT;
+  out.payload = (uint8_t *)self->frame;
+  out.len = self->frame_length;
+
+  // Отправка идёт в задаче сервера, поэтому клиент, который не принимает данные,
+  // задержал бы и остальных клиентов, и HTTP. Такой клиент отключается: кадры -
+  // разница состояний, пропуск сломал бы его картину, а после переподключения
+  // он получит полный снимок.
+  for (uint8_t i = 0; i < self->ws_count;)
+  {
+    int fd = self->ws_clients[i];
+    // Закрытый сокет мог достаться обычному HTTP-клиенту - проверяем тип
+    if (httpd_ws_get_fd_info(self->handle, fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+    {
+      self->ws_clients[i] = self->ws_clients[--self->ws_count];
+      continue;
+    }
+    if (!socket_writable(fd) || httpd_ws_send_frame_async(self->handle, fd, &out) != ESP_OK)
+    {
+      httpd_sess_trigger_close(self->handle, fd);
+      self->ws_clients[i] = self->ws_clients[--self->ws_count];
+      continue;
+    }
+    i++;
+  }
+  self->frame_pending = false;
+#endif
+}
+
+#endif
@@ -0,0 +1,338 @@
+#include "job.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_reader.h"
+
+#define JOB_BINARY_VERSION 1
+#define JOB_BINARY_HEADER 20
+#define JOB_BINARY_SEGMENT 8
+
+namespace
+{
+  // Участок как он записан в запросе: любые два из шага, числа кадров и конца
+  struct SegmentRequest
+  {
+    bool has_step = false;
+    bool has_frames = false;
+    bool has_end = false;
+    bool has_speed = false;
+    long step_um = 0;
+    long frames = 0;
+    long end_um = 0;
+    float speed = 0;
+  };
+
+  bool read_mm(JsonReader &json, long &um)
+  {
+    float value;
+    if (!json.read_number(value))
+      return false;
+    um = lroundf(value * 1000.0f);
+    return true;
+  }
+
+  // Поле участка; known = false - ключ не относится к участку
+  bool read_segment_field(JsonReader &json, const char *key, SegmentRequest &segment, bool &known)
+  {
+    float value;
+    known = true;
+    if (strcmp(key, "frames") == 0)
+      return segment.has_frames = json.read_int(segment.frames);
+    if (strcmp(key, "speed") == 0)
+      return segment.has_speed = json.read_number(segment.speed);
+    if (strcmp(key, "end_mm") == 0)
+      return segment.has_end = read_mm(json, segment.end_um);
+    if (strcmp(key, "step_um") != 0)
+    {
+      known = false;
+      return true;
+    }
+    if (!json.read_number(value))
+      return false;
+    segment.has_step = true;
+    segment.step_um = lroundf(value);
+    return true;
+  }
+
+  bool read_camera(JsonReader &json, JobSpec &job, const char *&error)
+  {
+    char key[16];
+    long value;
+    if (!json.begin_object())
+      return false;
+    while (json.next_key(key, sizeof(key)))
+    {
+      int32_t *field = strcmp(key, "focus_ms") == 0     ? &job.focus_time
+                       : strcmp(key, "release_ms") == 0 ? &job.release_time
+                       : strcmp(key, "before_ms") == 0  ? &job.before_shoot_delay
+                       : strcmp(key, "after_ms") == 0   ? &job.after_shoot_delay
+                                                        : nullptr;
+      if (!field)
+      {
+        error = "Unknown camera field";
+        return false;
+      }
+      if (!json.read_int(value))
+        return false;
+      *field = value;
+    }
+    return json.ok();
+  }
+
+  bool read_after(JsonReader &json, JobSpec &job, const char *&error)
+  {
+    char name[8];
+    if (!json.read_string(name, sizeof(name)))
+      return false;
+    if (strcmp(name, "stay") == 0)
+      job.after = JOB_AFTER_STAY;
+    else if (strcmp(name, "return") == 0)
+      job.after = JOB_AFTER_RETURN;
+    else if (strcmp(name, "park") == 0)
+      job.after = JOB_AFTER_PARK;
+    else if (strcmp(name, "home") == 0)
+      job.after = JOB_AFTER_HOME;
+    else
+    {
+      error = "Unknown post-action";
+      return false;
+    }
+    return true;
+  }
+
+  // Сокращения раскрываются по порядку участков: конец участка считается от
+  // последнего кадра предыдущего, поэтому для end_mm нужна точка начала
+  bool resolve_segments(JobSpec &job, const SegmentRequest *requests, uint8_t count,
+                        const SegmentRequest &common, bool listed, const char *&error)
+  {
+    int64_t origin_um = job.start_um; // Первый кадр стека, затем последний кадр предыдущего участка
+    for (uint8_t i = 0; i < count; i++)
+    {
+      const SegmentRequest &request = requests[i];
+      JobSegment &segment = job.segments[i];
+      long step_um = request.has_step ? request.step_um : common.has_step ? common.step_um : job.segments[0].step_um;
+      long frames = request.has_frames ? request.frames : job.segments[0].frames;
+      float speed = request.has_speed ? request.speed : common.has_speed ? common.speed : job.segments[0].speed;
+
+      if (request.has_end)
+      {
+        if (!job.has_start)
+        {
+          error = "end_mm requires start_mm";
+          return false;
+        }
+        if (request.has_step && request.has_frames)
+        {
+          error = "Give two of step_um, frames, end_mm";
+          return false;
+        }
+        long distance = request.end_um - (long)origin_um;
+        long gaps = i == 0 ? request.frames - 1 : request.frames; // Промежутков до конца участка
+        if (request.has_frames && gaps > 0)
+        {
+          step_um = lroundf((float)distance / gaps);
+        }
+        else if (!request.has_frames)
+        {
+          if (step_um == 0)
+          {
+            error = "Step must not be zero";
+            return false;
+          }
+          step_um = distance < 0 ? -labs(step_um) : labs(step_um);
+          frames = labs(distance) / labs(step_um) + (i == 0 ? 1 : 0);
+        }
+      }
+      else if (!request.has_frames && listed)
+      {
+        error = "Segment needs frames or end_mm";
+        return false;
+      }
+
+      if (frames < 1 || frames > JOB_MAX_FRAMES)
+      {
+        error = "Segment frame count out of range";
+        return false;
+      }
+      segment.step_um = step_um;
+      segment.frames = frames;
+      segment.speed = speed;
+      origin_um += (int64_t)(i == 0 ? frames - 1 : frames) * step_um;
+    }
+    job.segment_count = count;
+    return true;
+  }
+
+  bool parse_json(const char *text, JobSpec &job, const char *&error)
+  {
+    JsonReader json(text);
+    SegmentRequest common; // Участок сокращённой записи и умолчания для списка участков
+    SegmentRequest requests[JOB_MAX_SEGMENTS];
+    uint8_t count = 0;
+    char key[16];
+    char mode[8];
+    long um;
+    bool known;
+
+    error = nullptr;
+    if (!json.begin_object())
+    {
+      error = "Malformed JSON";
+      return false;
+    }
+    while (json.next_key(key, sizeof(key)))
+    {
+      bool ok;
+      if (!read_segment_field(json, key, common, known))
+        ok = false;
+      else if (known)
+        ok = true;
+      else if (strcmp(key, "home") == 0)
+        ok = json.read_bool(job.home);
+      else if (strcmp(key, "preposition") == 0)
+        ok = json.read_bool(job.preposition);
+      else if (strcmp(key, "start_mm") == 0)
+      {
+        ok = job.has_start = read_mm(json, um);
+        job.start_um = um;
+      }
+      else if (strcmp(key, "park_mm") == 0)
+      {
+        ok = read_mm(json, um);
+        job.park_um = um;
+      }
+      else if (strcmp(key, "s_curve") == 0)
+        ok = json.read_bool(job.s_curve);
+      else if (strcmp(key, "mode") == 0)
+      {
+        ok = json.read_string(mode, sizeof(mode));
+        if (ok && strcmp(mode, "flyby") != 0 && strcmp(mode, "stepped") != 0)
+        {
+          error = "Unknown mode";
+          return false;
+        }
+        job.continuous = ok && strcmp(mode, "flyby") == 0;
+      }
+      else if (strcmp(key, "then") == 0)
+        ok = read_after(json, job, error);
+      else if (strcmp(key, "camera") == 0)
+        ok = read_camera(json, job, error);
+      else if (strcmp(key, "segments") == 0)
+      {
+        ok = json.begin_array();
+        while (ok && json.next_item())
+        {
+          if (count == JOB_MAX_SEGMENTS)
+          {
+            error = "Too many segments";
+            return false;
+          }
+          SegmentRequest &segment = requests[count++];
+          ok = json.begin_object();
+          while (ok && json.next_key(key, sizeof(key)))
+          {
+            ok = read_segment_field(json, key, segment, known);
+            if (ok && !known)
+            {
+              error = "Unknown segment field";
+              return false;
+            }
+          }
+          ok = ok && json.ok();
+        }
+        ok = ok && json.ok();
+      }
+      else
+      {
+        error = "Unknown field";
+        return false;
+      }
+      if (!ok)
+        break;
+    }
+    if (error)
+      return false;
+    if (!json.finished())
+    {
+      error = "Malformed JSON";
+      return false;
+    }
+
+    bool listed = count > 0;
+    if (!listed)
+    {
+      requests[0] = common; // Сокращённая запись: один участок с полями верхнего уровня
+      count = 1;
+    }
+    return resolve_segments(job, requests, count, common, listed, error);
+  }
+
+  uint16_t read_u16(const uint8_t *data) { return data[0] | data[1] << 8; }
+
+  int32_t read_i32(const uint8_t *data)
+  {
+    return (int32_t)((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+  }
+
+  bool parse_binary(const uint8_t *data, size_t length, JobSpec &job, const char *&error)
+  {
+    if (length < JOB_BINARY_HEADER || data[0] != JOB_BINARY_VERSION)
+    {
+      error = "Unsupported job format";
+      return false;
+    }
+    uint8_t count = data[3];
+    if (count == 0 || count > JOB_MAX_SEGMENTS || data[2] > JOB_AFTER_HOME)
+    {
+      error = "Invalid job header";
+      return false;
+    }
+    if (length != JOB_BINARY_HEADER + (size_t)count * JOB_BINARY_SEGMENT)
+    {
+      error = "Job length mismatch";
+      return false;
+    }
+
+    job.home = data[1] & 0x01;
+    job.has_start = data[1] & 0x02;
+    job.continuous = data[1] & 0x04;
+    job.s_curve = data[1] & 0x08;
+    job.preposition = data[1] & 0x10;
+    job.after = (JobAfter)data[2];
+    job.start_um = read_i32(data + 4);
+    job.park_um = read_i32(data + 8);
+    job.focus_time = read_u16(data + 12);
+    job.release_time = read_u16(data + 14);
+    job.before_shoot_delay = read_u16(data + 16);
+    job.after_shoot_delay = read_u16(data + 18);
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+      const uint8_t *record = data + JOB_BINARY_HEADER + i * JOB_BINARY_SEGMENT;
+      JobSegment &segment = job.segments[i];
+      segment.step_um = read_i32(record);
+      segment.frames = read_u16(record + 4);
+      segment.speed = read_u16(record + 6) / 1000.0f;
+      if (segment.frames < 1 || segment.frames > JOB_MAX_FRAMES)
+      {
+        error = "Segment frame count out of range";
+        return false;
+      }
+    }
+    job.segment_count = count;
+    return true;
+  }
+}
+
+bool parse_job(const char *body, size_t length, JobSpec &job, const char *&error)
+{
+  size_t i = 0;
+  while (i < length && (body[i] == ' ' || body[i] == '\t' || body[i] == '\r' || body[i] == '\n'))
+    i++;
+  if (i < length && body[i] == '{')
+    return parse_json(body + i, job, error);
+  return parse_binary((const uint8_t *)body, length, job, error);
+}
@@ -0,0 +1,134 @@
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#define LOG_DRAIN_PERIOD_MS 10
+
+static_assert((LOG_SLOTS & (LOG_SLOTS - 1)) == 0, "LOG_SLOTS must be a power of two");
+
+Logger rail_log;
+
+void Logger::begin(uint8_t core, uint8_t priority)
+{
+  history_lock = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(task, "log", 3072, this, priority, nullptr, core);
+}
+
+// Слот свободен для записи с номером pos, когда его номер последовательности
+// равен pos; заполненный слот получает pos + 1, прочитанный - pos + LOG_SLOTS.
+// Хранится номер минус индекс слота, чтобы начальным состоянием были нули.
+void Logger::write(uint8_t level, const char *format, ...)
+{
+  uint32_t pos = head.load(std::memory_order_relaxed);
+  uint32_t index;
+  Slot *slot;
+  for (;;)
+  {
+    index = pos & (LOG_SLOTS - 1);
+    slot = &slots[index];
+    int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) + index - pos);
+    if (diff == 0 && head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      break;
+    if (diff < 0)
+    {
+      dropped_count.fetch_add(1, std::memory_order_relaxed); // Выгрузка отстала - запись теряется
+      return;
+    }
+    if (diff > 0)
+      pos = head.load(std::memory_order_relaxed); // Слот занят другой задачей
+  }
+
+  slot->time_ms = millis();
+  slot->level = level;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(slot->text, sizeof(slot->text), format, args);
+  va_end(args);
+  slot->sequence.store(pos + 1 - index, std::memory_order_release);
+}
+
+void Logger::task(void *arg)
+{
+  Logger *self = static_cast<Logger *>(arg);
+  for (;;)
+  {
+    while (self->drain_one())
+    {
+    }
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_PERIOD_MS));
+  }
+}
+
+bool Logger::drain_one()
+{
+  static const char level_tags[] = "-EWID";
+  uint32_t index = tail & (LOG_SLOTS - 1);
+  Slot &slot = slots[index];
+  if (slot.sequence.load(std::memory_order_acquire) + index != tail + 1)
+    return false; // Пусто, или запись ещё форматируется
+
+  char line[LOG_LINE_MAX + 16];
+  int length = snprintf(line, sizeof(line), "%lu.%03lu %c %s", (unsigned long)(slot.time_ms / 1000),
+                        (unsigned long)(slot.time_ms % 1000), level_tags[slot.level <= RAIL_LOG_DEBUG ? slot.level : 0],
+                        slot.text);
+  slot.sequence.store(tail + LOG_SLOTS - index, std::memory_order_release);
+  tail++;
+
+  if (length < 0)
+    return true;
+  if ((size_t)length > sizeof(line) - 2)
+    length = sizeof(line) - 2;
+  // Строки, уже заканчивающиеся переводом строки, остались от прежних Serial.printf
+  if (length == 0 || line[length - 1] != '\n')
+    line[length++] = '\n';
+  line[length] = 0;
+
+  Serial.write((const uint8_t *)line, length);
+  append_history(line, length);
+  return true;
+}
+
+void Logger::append_history(const char *line, size_t length)
+{
+  xSemaphoreTake(history_lock, portMAX_DELAY);
+  for (size_t i = 0; i < length; i++)
+  {
+    history[history_end++] = line[i];
+    if (history_end == LOG_HISTORY)
+    {
+      history_end = 0;
+      history_wrapped = true;
+    }
+  }
+  xSemaphoreGive(history_lock);
+}
+
+size_t Logger::copy_history(char *out, size_t size)
+{
+  if (!history_lock || size == 0)
+    return 0;
+  xSemaphoreTake(history_lock, portMAX_DELAY);
+  bool wrapped = history_wrapped;
+  size_t start = wrapped ? history_end : 0;
+  size_t available = wrapped ? LOG_HISTORY : history_end;
+  size_t skip = available > size - 1 ? available - (size - 1) : 0;
+  size_t used = 0;
+  for (size_t i = skip; i < available; i++)
+    out[used++] = history[(start + i) % LOG_HISTORY];
+  xSemaphoreGive(history_lock);
+
+  // Первая строка после переноса кольца обрезана - её пропускаем
+  size_t first = 0;
+  if (wrapped || skip)
+  {
+    while (first < used && out[first] != '\n')
+      first++;
+    if (first < used)
+      first++;
+    memmove(out, out + first, used - first);
+    used -= first;
+  }
+  out[used] = 0;
+  return used;
+}
@@ -0,0 +1,213 @@
+#include "motion_profile.h"
+
+#include <math.h>
+
+namespace
+{
+  // Форма разгона от нуля до v_peak: нарастание ускорения (t_j), постоянное
+  // ускорение (t_a), спад ускорения (t_j). Для трапеции t_j = 0.
+  struct RampShape
+  {
+    float jerk;
+    float accel;
+    float t_j;
+    float t_a;
+    float v_peak;
+
+    static RampShape make(float v_peak, float acceleration, float jerk)
+    {
+      RampShape shape;
+      shape.v_peak = v_peak;
+      if (jerk <= 0)
+      {
+        shape.jerk = 0;
+        shape.accel = acceleration;
+        shape.t_j = 0;
+        shape.t_a = v_peak / acceleration;
+      }
+      else if (v_peak * jerk < acceleration * acceleration)
+      {
+        // Заданное ускорение не успевает набраться
+        shape.jerk = jerk;
+        shape.accel = sqrtf(v_peak * jerk);
+        shape.t_j = shape.accel / jerk;
+        shape.t_a = 0;
+      }
+      else
+      {
+        shape.jerk = jerk;
+        shape.accel = acceleration;
+        shape.t_j = acceleration / jerk;
+        shape.t_a = v_peak / acceleration - shape.t_j;
+      }
+      return shape;
+    }
+
+    float duration() const { return 2 * t_j + t_a; }
+
+    // Скорость симметрична относительно середины разгона
+    float length() const { return v_peak * (t_j + t_a / 2); }
+
+    float position_at(float t) const
+    {
+      if (t <= t_j)
+        return jerk * t * t * t / 6;
+      float s1 = jerk * t_j * t_j * t_j / 6;
+      float v1 = jerk * t_j * t_j / 2;
+      t -= t_j;
+      if (t <= t_a)
+        return s1 + v1 * t + accel * t * t / 2;
+      float s2 = s1 + v1 * t_a + accel * t_a * t_a / 2;
+      float v2 = v1 + accel * t_a;
+      t -= t_a;
+      if (t > t_j)
+        t = t_j;
+      return s2 + v2 * t + accel * t * t / 2 - jerk * t * t * t / 6;
+    }
+
+    float time_at(float s) const
+    {
+      if (jerk == 0)
+        return sqrtf(2 * s / accel);
+      float low = 0;
+      float high = duration();
+      for (uint8_t i = 0; i < 24; i++)
+      {
+        float mid = (low + high) / 2;
+        if (position_at(mid) < s)
+          low = mid;
+        else
+          high = mid;
+      }
+      return (low + high) / 2;
+    }
+  };
+
+  uint32_t to_interval_q8(float seconds, uint32_t timer_hz)
+  {
+    float q8 = seconds * timer_hz * 256.0f;
+    if (q8 < StepSchedule::MIN_INTERVAL * 256.0f)
+      return StepSchedule::MIN_INTERVAL * 256;
+    if (q8 > 4.0e9f)
+      return 4000000000u;
+    return (uint32_t)q8;
+  }
+}
+
+void StepSchedule::clear()
+{
+  ramp_count = 0;
+  ramp_total = 0;
+  ramp_q8 = 0;
+  cruise_steps = 0;
+  cruise_q8 = 0;
+  phase = DONE;
+  index = 0;
+  left_in_segment = 0;
+  interval_q8 = 0;
+  fraction = 0;
+  planned_steps = 0;
+  remaining_steps = 0;
+}
+
+void StepSchedule::plan(uint32_t steps, const MotionLimits &limits, uint32_t timer_hz)
+{
+  clear();
+  if (steps == 0 || limits.max_speed <= 0)
+    return;
+
+  float v_peak = limits.max_speed;
+  if (limits.acceleration > 0)
+  {
+    // На короткой дистанции пиковая скорость снижается, чтобы разгон и торможение уместились
+    if (2 * RampShape::make(v_peak, limits.acceleration, limits.jerk).length() > steps)
+    {
+      float low = 0;
+      float high = v_peak;
+      for (uint8_t i = 0; i < 24; i++)
+      {
+        float mid = (low + high) / 2;
+        if (2 * RampShape::make(mid, limits.acceleration, limits.jerk).length() > steps)
+          high = mid;
+        else
+          low = mid;
+      }
+      v_peak = low;
+    }
+
+    RampShape shape = RampShape::make(v_peak, limits.acceleration, limits.jerk);
+    ramp_total = (uint32_t)shape.length();
+    if (ramp_total > steps / 2)
+      ramp_total = steps / 2;
+
+    // Длинный разгон группируется по per_segment шагов со средним интервалом
+    uint32_t per_segment = (ramp_total + MAX_RAMP_SEGMENTS - 1) / MAX_RAMP_SEGMENTS;
+    float previous_time = 0;
+    for (uint32_t start = 0; start < ramp_total; start += per_segment)
+    {
+      uint32_t count = ramp_total - start < per_segment ? ramp_total - start : per_segment;
+      float end_time = shape.time_at(start + count);
+      ramp[ramp_count].interval = to_interval_q8((end_time - previous_time) / count, timer_hz);
+      ramp[ramp_count].count = count;
+      ramp_q8 += (uint64_t)ramp[ramp_count].interval * count;
+      ramp_count++;
+      previous_time = end_time;
+    }
+  }
+
+  cruise_steps = steps - 2 * ramp_total;
+  cruise_q8 = v_peak > 0 ? to_interval_q8(1.0f / v_peak, timer_hz) : to_interval_q8(1.0f, timer_hz);
+  planned_steps = steps;
+  remaining_steps = steps;
+
+  if (ramp_count > 0)
+  {
+    phase = RAMP_UP;
+    left_in_segment = ramp[0].count;
+    interval_q8 = ramp[0].interval;
+  }
+  else
+  {
+    phase = CRUISE;
+    left_in_segment = cruise_steps;
+    interval_q8 = cruise_q8;
+  }
+}
+
+uint64_t StepSchedule::ticks_until(uint32_t step) const
+{
+  if (step > planned_steps)
+    step = planned_steps;
+
+  // Дробь тика в next_interval() переносится между шагами, поэтому сумма
+  // выданных интервалов - целая часть суммы в Q8
+  uint64_t sum_q8 = 0;
+  uint32_t left = step;
+  if (left >= ramp_total)
+  {
+    sum_q8 = ramp_q8;
+    left -= ramp_total;
+  }
+  else
+  {
+    for (uint16_t i = 0; i < ramp_count && left > 0; i++)
+    {
+      uint32_t count = left < ramp[i].count ? left : ramp[i].count;
+      sum_q8 += (uint64_t)ramp[i].interval * count;
+      left -= count;
+    }
+  }
+
+  uint32_t cruise = left < cruise_steps ? left : cruise_steps;
+  sum_q8 += (uint64_t)cruise_q8 * cruise;
+  left -= cruise;
+
+  // Торможение - та же таблица в обратном порядке
+  for (uint16_t i = ramp_count; i > 0 && left > 0; i--)
+  {
+    uint32_t count = left < ramp[i - 1].count ? left : ramp[i - 1].count;
+    sum_q8 += (uint64_t)ramp[i - 1].interval * count;
+    left -= count;
+  }
+  return sum_q8 >> 8;
+}
@@ -0,0 +1,128 @@
+#include "rail_store.h"
+
+#include <Preferences.h>
+
+#define STORE_VERSION 1
+#define STORE_NAMESPACE "rail"
+#define STORE_SETTINGS_KEY "settings"
+#define STORE_POSITION_KEY "position"
+
+namespace
+{
+  // Поле за полем: байты выравнивания в снимке не обязаны совпадать
+  bool same_settings(const MacroRailBase::Settings &a, const MacroRailBase::Settings &b)
+  {
+    return a.step_size_um == b.step_size_um && a.total_photos == b.total_photos &&
+           a.max_speed == b.max_speed && a.focus_time == b.focus_time &&
+           a.release_time == b.release_time && a.before_shoot_delay == b.before_shoot_delay &&
+           a.after_shoot_delay == b.after_shoot_delay && a.s_curve == b.s_curve &&
+           a.continuous == b.continuous;
+  }
+}
+
+bool RailStore::load_settings(MacroRailBase::Settings &settings)
+{
+  Preferences preferences;
+  StoredSettings stored;
+  preferences.begin(STORE_NAMESPACE, true);
+  size_t length = preferences.getBytes(STORE_SETTINGS_KEY, &stored, sizeof(stored));
+  preferences.end();
+  if (length != sizeof(stored) || stored.version != STORE_VERSION)
+    return false; // Другая версия прошивки: настройки по умолчанию
+  saved_settings = stored;
+  settings = stored.settings;
+  return true;
+}
+
+bool RailStore::load_position(int64_t &steps)
+{
+  Preferences preferences;
+  StoredPosition stored;
+  preferences.begin(STORE_NAMESPACE, true);
+  size_t length = preferences.getBytes(STORE_POSITION_KEY, &stored, sizeof(stored));
+  preferences.end();
+  if (length != sizeof(stored))
+    return false;
+  saved_position = stored;
+  if (!stored.clean || stored.signature != signature)
+    return false;
+  steps = stored.steps;
+  return true;
+}
+
+void RailStore::track(const MacroRailBase::Status &status)
+{
+  uint32_t now = millis();
+
+  // Настройки: ждём паузы в изменениях, чтобы серия правок из формы была одной записью
+  if (!same_settings(status.settings, saved_settings.settings))
+  {
+    if (!settings_pending || !same_settings(status.settings, pending_settings))
+    {
+      pending_settings = status.settings;
+      settings_changed_ms = now;
+      settings_pending = true;
+    }
+    else if (now - settings_changed_ms >= STORE_SETTINGS_DELAY_MS)
+    {
+      write_settings(status.settings);
+      settings_pending = false;
+    }
+  }
+  else
+  {
+    settings_pending = false;
+  }
+
+  // Позиция верна, только пока рельс привязан и стоит
+  bool resting = status.referenced && status.state == MacroRailBase::IDLE &&
+                 status.job_stage == MacroRailBase::JOB_NONE;
+  if (!resting)
+  {
+    at_rest = false;
+    if (saved_position.clean)
+      write_position(saved_position.steps, false);
+    return;
+  }
+  if (!at_rest || status.steps != rest_steps)
+  {
+    at_rest = true;
+    rest_steps = status.steps;
+    rest_since_ms = now;
+    return;
+  }
+  if (now - rest_since_ms >= STORE_POSITION_DELAY_MS &&
+      (!saved_position.clean || saved_position.steps != rest_steps || saved_position.signature != signature))
+    write_position(rest_steps, true);
+}
+
+void RailStore::write_settings(const MacroRailBase::Settings &settings)
+{
+  StoredSettings stored = {};
+  stored.version = STORE_VERSION;
+  stored.settings = settings;
+  Preferences preferences;
+  preferences.begin(STORE_NAMESPACE, false);
+  if (preferences.putBytes(STORE_SETTINGS_KEY, &stored, sizeof(stored)) == sizeof(stored))
+  {
+    saved_settings = stored;
+    write_count++;
+  }
+  preferences.end();
+}
+
+void RailStore::write_position(int64_t steps, bool clean)
+{
+  StoredPosition stored = {};
+  stored.signature = signature;
+  stored.steps = steps;
+  stored.clean = clean;
+  Preferences preferences;
+  preferences.begin(STORE_NAMESPACE, false);
+  if (preferences.putBytes(STORE_POSITION_KEY, &stored, sizeof(stored)) == sizeof(stored))
+  {
+    saved_position = stored;
+    write_count++;
+  }
+  preferences.end();
+}
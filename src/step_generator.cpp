@@ -0,0 +1,63 @@
+#include "step_generator.h"
+
+void ScheduledStepGenerator::move_to(int64_t absolute)
+{
+  // Перепланирование на ходу начинается с покоя: MacroRail всегда дожидается остановки
+  if (running)
+    stop();
+
+  target = absolute;
+  int64_t distance = absolute - current_position();
+  if (distance == 0)
+    return;
+
+  direction = distance > 0 ? 1 : -1;
+  set_direction_pin(distance > 0);
+  schedule.plan((uint32_t)(distance > 0 ? distance : -distance), limits, timer_hz);
+
+  uint32_t first = schedule.next_interval();
+  if (first == 0)
+  {
+    target = current_position();
+    return;
+  }
+  current_interval = first;
+  running = true;
+  start_timer(first);
+}
+
+void ScheduledStepGenerator::stop()
+{
+  stop_timer();
+  running = false;
+  current_interval = 0;
+  target = current_position();
+}
+
+int64_t ScheduledStepGenerator::current_position() const
+{
+  // Повторное чтение защищает от разорванного значения, если прерывание
+  // изменило одну из половин между двумя 32-битными загрузками
+  int64_t first, second;
+  do
+  {
+    first = position;
+    second = position;
+  } while (first != second);
+  return first;
+}
+
+void ScheduledStepGenerator::set_current_position(int64_t new_position)
+{
+  stop();
+  position = new_position;
+  target = new_position;
+}
+
+float ScheduledStepGenerator::speed() const
+{
+  uint32_t interval = current_interval;
+  if (!running || interval == 0)
+    return 0;
+  return direction * (float)timer_hz / interval;
+}
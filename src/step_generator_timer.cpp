@@ -0,0 +1,118 @@
+#if defined(ESP32)
+
+#include "step_generator_timer.h"
+#include "step_trace.h"
+
+#include <Arduino.h>
+#include <hal/cpu_hal.h>
+#include <soc/gpio_struct.h>
+
+TimerStepGenerator::TimerStepGenerator(uint8_t step_pin, uint8_t dir_pin, bool invert_dir,
+                                       timer_group_t group, timer_idx_t index)
+    : ScheduledStepGenerator(STEP_TIMER_HZ),
+      step_pin(step_pin),
+      dir_pin(dir_pin),
+      invert_dir(invert_dir),
+      group(group),
+      index(index),
+      step_mask(1u << (step_pin & 31)),
+      step_high_bank(step_pin >= 32)
+{
+}
+
+void TimerStepGenerator::begin()
+{
+  pinMode(step_pin, OUTPUT);
+  digitalWrite(step_pin, LOW);
+  pinMode(dir_pin, OUTPUT);
+
+  pulse_cycles = STEP_PULSE_US * getCpuFrequencyMhz();
+
+  timer_config_t config = {};
+  config.divider = STEP_TIMER_DIVIDER;
+  config.counter_dir = TIMER_COUNT_UP;
+  config.counter_en = TIMER_PAUSE;
+  config.alarm_en = TIMER_ALARM_EN;
+  config.auto_reload = TIMER_AUTORELOAD_EN;
+  config.intr_type = TIMER_INTR_LEVEL;
+  timer_init(group, index, &config);
+  timer_set_counter_value(group, index, 0);
+  timer_isr_callback_add(group, index, on_timer, this, ESP_INTR_FLAG_IRAM);
+}
+
+void TimerStepGenerator::set_direction_pin(bool forward)
+{
+  digitalWrite(dir_pin, (forward != invert_dir) ? HIGH : LOW);
+  delayMicroseconds(1); // Время установки DIR перед первым STEP
+}
+
+void TimerStepGenerator::start_timer(uint32_t first_interval)
+{
+  timer_pause(group, index);
+  timer_set_counter_value(group, index, 0);
+  timer_set_alarm_value(group, index, first_interval);
+  timer_set_alarm(group, index, TIMER_ALARM_EN);
+  TRACE_MOVE_AT(StepTrace::now(), direction > 0);
+  timer_start(group, index);
+}
+
+void TimerStepGenerator::stop_timer()
+{
+  // Под спинлоком, чтобы прерывание не выдало шаг после остановки
+  portENTER_CRITICAL(&timer_mux);
+  timer_pause(group, index);
+  running = false;
+  portEXIT_CRITICAL(&timer_mux);
+}
+
+void IRAM_ATTR TimerStepGenerator::stop_timer_from_isr()
+{
+  portENTER_CRITICAL_ISR(&timer_mux);
+  timer_group_set_counter_enable_in_isr(group, index, TIMER_PAUSE);
+  running = false;
+  portEXIT_CRITICAL_ISR(&timer_mux);
+}
+
+bool IRAM_ATTR TimerStepGenerator::on_timer(void *arg)
+{
+  TimerStepGenerator *self = static_cast<TimerStepGenerator *>(arg);
+
+  portENTER_CRITICAL_ISR(&self->timer_mux);
+  if (!self->running)
+  {
+    portEXIT_CRITICAL_ISR(&self->timer_mux);
+    return false;
+  }
+
+  uint32_t pulse_start = cpu_hal_get_cycle_count();
+  if (self->step_high_bank)
+    GPIO.out1_w1ts.val = self->step_mask;
+  else
+    GPIO.out_w1ts = self->step_mask;
+
+  // Расчёт следующего интервала идёт, пока STEP удерживается в высоком уровне
+  TRACE_STEP_AT(pulse_start, self->current_interval);
+  uint32_t next = self->on_step();
+  if (next == 0)
+  {
+    timer_group_set_counter_enable_in_isr(self->group, self->index, TIMER_PAUSE);
+  }
+  else
+  {
+    timer_group_set_alarm_value_in_isr(self->group, self->index, next);
+    timer_group_enable_alarm_in_isr(self->group, self->index);
+  }
+
+  while (cpu_hal_get_cycle_count() - pulse_start < self->pulse_cycles)
+  {
+  }
+  if (self->step_high_bank)
+    GPIO.out1_w1tc.val = self->step_mask;
+  else
+    GPIO.out_w1tc = self->step_mask;
+
+  portEXIT_CRITICAL_ISR(&self->timer_mux);
+  return false;
+}
+
+#endif
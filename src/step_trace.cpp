@@ -0,0 +1,128 @@
+#include "step_trace.h"
+
+#if STEP_TRACE
+
+static_assert((STEP_TRACE_RECORDS & (STEP_TRACE_RECORDS - 1)) == 0, "STEP_TRACE_RECORDS must be a power of two");
+static_assert(sizeof(StepTraceRecord) == 8 && sizeof(StepTraceHeader) == 24,
+              "trace layout is part of the download format");
+
+StepTrace step_trace;
+
+void StepTrace::begin(uint32_t generator_hz)
+{
+#if defined(ESP32)
+  cpu_hz = getCpuFrequencyMhz() * 1000000UL;
+#else
+  cpu_hz = 1000000UL;
+#endif
+  timer_hz = generator_hz;
+  cycles_per_tick = cpu_hz / timer_hz ? cpu_hz / timer_hz : 1;
+}
+
+void StepTrace::start()
+{
+  portENTER_CRITICAL(&mux);
+  written = 0;
+  last_cycles = now();
+  armed = true;
+  portEXIT_CRITICAL(&mux);
+}
+
+void StepTrace::stop()
+{
+  portENTER_CRITICAL(&mux);
+  armed = false;
+  portEXIT_CRITICAL(&mux);
+}
+
+void STEP_ISR_ATTR StepTrace::append(uint32_t cycles, int16_t error, uint8_t type, uint8_t value)
+{
+  StepTraceRecord &record = records[written & (STEP_TRACE_RECORDS - 1)];
+  record.cycles = cycles;
+  record.error = error;
+  record.type = type;
+  record.value = value;
+  written++;
+}
+
+void STEP_ISR_ATTR StepTrace::step(uint32_t cycles, uint32_t scheduled)
+{
+  portENTER_CRITICAL_SAFE(&mux);
+  if (armed)
+  {
+    // Интервал - от предыдущего шага или запуска движения
+    int32_t error = (int32_t)((cycles - last_cycles) / cycles_per_tick) - (int32_t)scheduled;
+    if (error > INT16_MAX)
+      error = INT16_MAX;
+    else if (error < INT16_MIN)
+      error = INT16_MIN;
+    append(cycles, (int16_t)error, TRACE_STEP, 0);
+    last_cycles = cycles;
+  }
+  portEXIT_CRITICAL_SAFE(&mux);
+}
+
+void STEP_ISR_ATTR StepTrace::move(uint32_t cycles, bool forward)
+{
+  portENTER_CRITICAL_SAFE(&mux);
+  if (armed)
+  {
+    append(cycles, 0, TRACE_MOVE, forward ? 1 : 0);
+    last_cycles = cycles;
+  }
+  portEXIT_CRITICAL_SAFE(&mux);
+}
+
+void StepTrace::event(StepTraceEvent type, uint8_t value)
+{
+  portENTER_CRITICAL(&mux);
+  if (armed)
+    append(now(), 0, type, value);
+  portEXIT_CRITICAL(&mux);
+}
+
+bool StepTrace::pause()
+{
+  portENTER_CRITICAL(&mux);
+  bool was_active = armed;
+  armed = false;
+  portEXIT_CRITICAL(&mux);
+  return was_active;
+}
+
+void StepTrace::resume(bool was_active)
+{
+  if (!was_active)
+    return;
+  portENTER_CRITICAL(&mux);
+  append(now(), 0, TRACE_GAP, 0);
+  last_cycles = now();
+  armed = true;
+  portEXIT_CRITICAL(&mux);
+}
+
+StepTraceHeader StepTrace::header() const
+{
+  StepTraceHeader header = {};
+  header.magic = STEP_TRACE_MAGIC;
+  header.version = STEP_TRACE_VERSION;
+  header.record_size = sizeof(StepTraceRecord);
+  header.cpu_hz = cpu_hz;
+  header.timer_hz = timer_hz;
+  header.count = written < STEP_TRACE_RECORDS ? written : STEP_TRACE_RECORDS;
+  header.lost = written - header.count;
+  return header;
+}
+
+// Вызывается только между pause() и resume(): кольцо не меняется
+size_t StepTrace::read(size_t first, StepTraceRecord *out, size_t count) const
+{
+  uint32_t stored = written < STEP_TRACE_RECORDS ? written : STEP_TRACE_RECORDS;
+  uint32_t oldest = written - stored;
+  size_t copied = 0;
+  for (size_t i = first; i < stored && copied < count; i++)
+    out[copied++] = records[(oldest + i) & (STEP_TRACE_RECORDS - 1)];
+  return copied;
+}
+
+#endif
@@ -0,0 +1,197 @@
+#include "wifi_manager.h"
+
+#include <Preferences.h>
+#include <WiFi.h>
+
+#include "log.h"
+
+#define WIFI_CACHE_VERSION 1
+#define WIFI_CACHE_NAMESPACE "wifi"
+#define WIFI_CACHE_KEY "cache"
+
+void WifiManager::begin(uint8_t core, uint8_t priority)
+{
+  WiFi.persistent(false); // Конфигурация драйвера не пишется во flash при каждом begin(): свой кэш - ниже
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+  xTaskCreatePinnedToCore(task, "wifi", 4096, this, priority, nullptr, core);
+}
+
+WifiReport WifiManager::report() const
+{
+  WifiReport report;
+  report.connected = WiFi.status() == WL_CONNECTED;
+  report.fast = fast;
+  report.rssi = report.connected ? WiFi.RSSI() : 0;
+  report.ready_ms = ready_ms;
+  report.connects = connects;
+  return report;
+}
+
+void WifiManager::task(void *arg)
+{
+  static_cast<WifiManager *>(arg)->run();
+}
+
+void WifiManager::run()
+{
+  bool up = connect_cached() || connect_scanned();
+  uint32_t lost_since = millis();
+  for (;;)
+  {
+    if (up)
+    {
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      if (WiFi.status() == WL_CONNECTED)
+        continue;
+      // Короткие обрывы восстанавливает сам драйвер (auto reconnect)
+      up = false;
+      lost_since = millis();
+      LOG_WARN("WiFi: connection lost");
+      continue;
+    }
+
+    if (WiFi.status() == WL_CONNECTED)
+    {
+      up = true;
+      connects++;
+      LOG_INFO("WiFi: reconnected, IP %s", WiFi.localIP().toString().c_str());
+      continue;
+    }
+    if (ready_ms && millis() - lost_since < WIFI_LOST_MS)
+    {
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+    if (ready_ms)
+      WiFi.disconnect(); // Драйвер так и не восстановил связь - выбираем точку заново
+    up = connect_scanned();
+    if (!up)
+      vTaskDelay(pdMS_TO_TICKS(WIFI_RETRY_MS));
+  }
+}
+
+// Статический IP из прошлого ответа DHCP и известные BSSID и канал убирают
+// сканирование каналов и обмен DHCP - самые долгие части подключения
+bool WifiManager::connect_cached()
+{
+  Preferences preferences;
+  Cache cache;
+  preferences.begin(WIFI_CACHE_NAMESPACE, true);
+  size_t length = preferences.getBytes(WIFI_CACHE_KEY, &cache, sizeof(cache));
+  preferences.end();
+  if (length != sizeof(cache) || cache.version != WIFI_CACHE_VERSION)
+    return false;
+  cache.ssid[sizeof(cache.ssid) - 1] = 0;
+  const WifiCredentials *known = find(cache.ssid);
+  if (!known)
+    return false; // Сеть убрали из списка
+
+  LOG_INFO("WiFi: fast connect to %s, channel %u", cache.ssid, (unsigned)cache.channel);
+  WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+  WiFi.begin(known->ssid, known->password, cache.channel, cache.bssid);
+  if (wait_connected(WIFI_FAST_TIMEOUT_MS))
+  {
+    connected(true);
+    return true;
+  }
+
+  LOG_WARN("WiFi: cached access point unavailable");
+  WiFi.disconnect();
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // Обратно на DHCP
+  return false;
+}
+
+// Одно сканирование; известные сети пробуются от самой сильной к слабой
+bool WifiManager::connect_scanned()
+{
+  int16_t found = WiFi.scanNetworks();
+  if (found > 32)
+    found = 32; // Маска опробованных точек
+  uint32_t tried = 0;
+  for (;;)
+  {
+    int best = -1;
+    const WifiCredentials *best_known = nullptr;
+    for (int i = 0; i < found; i++)
+    {
+      if (tried & (1UL << i))
+        continue;
+      const WifiCredentials *known = find(WiFi.SSID(i).c_str());
+      if (known && (best < 0 || WiFi.RSSI(i) > WiFi.RSSI(best)))
+      {
+        best = i;
+        best_known = known;
+      }
+    }
+    if (best < 0)
+      break;
+    tried |= 1UL << best;
+
+    LOG_INFO("WiFi: connecting to %s, %ld dBm, channel %ld",
+             best_known->ssid, (long)WiFi.RSSI(best), (long)WiFi.channel(best));
+    WiFi.begin(best_known->ssid, best_known->password, WiFi.channel(best), WiFi.BSSID(best));
+    if (wait_connected(WIFI_CONNECT_TIMEOUT_MS))
+    {
+      WiFi.scanDelete();
+      connected(false);
+      return true;
+    }
+    WiFi.disconnect();
+  }
+  WiFi.scanDelete();
+  LOG_WARN("WiFi: no known network among %d found", (int)found);
+  return false;
+}
+
+bool WifiManager::wait_connected(uint32_t timeout_ms)
+{
+  uint32_t start = millis();
+  while (millis() - start < timeout_ms)
+  {
+    int status = WiFi.status();
+    if (status == WL_CONNECTED)
+      return true;
+    if (status == WL_CONNECT_FAILED)
+      return false; // Неверный пароль - ждать нечего
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+  return false;
+}
+
+void WifiManager::connected(bool cached)
+{
+  fast = cached;
+  connects++;
+  if (!ready_ms)
+    ready_ms = millis();
+  LOG_INFO("WiFi: connected to %s in %lums (%s), IP %s", WiFi.SSID().c_str(),
+           (unsigned long)ready_ms, cached ? "cached" : "scan", WiFi.localIP().toString().c_str());
+
+  Cache cache = {};
+  cache.version = WIFI_CACHE_VERSION;
+  strncpy(cache.ssid, WiFi.SSID().c_str(), sizeof(cache.ssid) - 1);
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = WiFi.localIP();
+  cache.gateway = WiFi.gatewayIP();
+  cache.subnet = WiFi.subnetMask();
+  cache.dns = WiFi.dnsIP();
+
+  // Запись во flash - только при изменении: обычная перезагрузка её не тратит
+  Preferences preferences;
+  Cache stored;
+  preferences.begin(WIFI_CACHE_NAMESPACE, false);
+  if (preferences.getBytes(WIFI_CACHE_KEY, &stored, sizeof(stored)) != sizeof(stored) ||
+      memcmp(&stored, &cache, sizeof(cache)) != 0)
+    preferences.putBytes(WIFI_CACHE_KEY, &cache, sizeof(cache));
+  preferences.end();
+}
+
+const WifiCredentials *WifiManager::find(const char *ssid) const
+{
+  for (const WifiCredentials *network = networks; network->ssid; network++)
+    if (strcmp(network->ssid, ssid) == 0)
+      return network;
+  return nullptr;
+}
@@ -0,0 +1,465 @@
+// Бенчмарки: потолок шаг/с таблиц StepSchedule против AccelStepper::run() (на плате) и
+// всего пути шага, стоимость MacroRail::update() по состояниям, ответы /status
+// и / и разбор /start - время и число выделений памяти.
+// Результаты печатаются строками JSON с префиксом BENCH для сравнения между
+// версиями (tools/bench_compare.py).
+//   pio test -e native -f test_bench
+//   pio test -e mhetesp32devkit -f test_bench
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "motion_profile.h"
+#include "rail_api.h"
+#include "step_generator_sim.h"
+
+#if defined(ARDUINO)
+#include <AccelStepper.h>
+#include <Arduino.h>
+#define BENCH_STEP_PIN 25 // Свободные пины: бенчмарк не должен двигать рельс
+#define BENCH_DIR_PIN 26
+static uint64_t now_us() { return micros(); }
+static uint64_t now_ns() { return now_us() * 1000; }
+#else
+#include <chrono>
+
+#include "rail_sim.h"
+
+static uint64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+static uint64_t now_us() { return now_ns() / 1000; }
+#endif
+
+// Счётчик выделений памяти за замер. На хосте (glibc) перехвачен malloc, через
+// который идут и new, и strdup; на плате - только operator new, malloc из C
+// libc ESP-IDF не перехватить без правки сборки.
+static volatile uint32_t allocations;
+
+#if defined(__GLIBC__)
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+  allocations++;
+  return __libc_realloc(pointer, size);
+}
+#else
+void *operator new(size_t size)
+{
+  allocations++;
+  void *pointer = malloc(size ? size : 1);
+  if (!pointer)
+    abort();
+  return pointer;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete[](void *pointer) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { free(pointer); }
+#endif
+
+static const uint32_t BENCH_TIMER_HZ = 10000000;
+static const float STEPS_PER_MM = 7266.67f;
+static volatile uint32_t sink; // Не даёт компилятору выбросить цикл
+
+static void report(const char *name, uint32_t steps, uint64_t elapsed_us)
+{
+  char line[160];
+  snprintf(line, sizeof(line), "BENCH {\"name\":\"%s\",\"steps\":%lu,\"us\":%llu,\"steps_per_s\":%.0f}",
+           name, (unsigned long)steps, (unsigned long long)elapsed_us,
+           elapsed_us ? steps * 1e6 / elapsed_us : 0.0);
+  printf("%s\n", line);
+}
+
+static void report_calls(const char *name, uint32_t calls, uint64_t elapsed_ns, uint32_t allocs)
+{
+  char line[160];
+  snprintf(line, sizeof(line), "BENCH {\"name\":\"%s\",\"calls\":%lu,\"ns_per_call\":%.1f,\"allocs_per_call\":%.2f}",
+           name, (unsigned long)calls, calls ? (double)elapsed_ns / calls : 0.0, calls ? (double)allocs / calls : 0.0);
+  printf("%s\n", line);
+}
+
+static void bench_schedule(const char *name, float jerk)
+{
+  static StepSchedule schedule;
+  MotionLimits limits;
+  limits.max_speed = 20 * STEPS_PER_MM;
+  limits.acceleration = 100 * STEPS_PER_MM;
+  limits.jerk = jerk * STEPS_PER_MM;
+
+  const uint32_t steps = 200000;
+  uint64_t start = now_us();
+  schedule.plan(steps, limits, BENCH_TIMER_HZ);
+  uint32_t emitted = 0;
+  uint32_t interval;
+  while ((interval = schedule.next_interval()) != 0)
+  {
+    sink += interval;
+    emitted++;
+  }
+  report(name, emitted, now_us() - start);
+  TEST_ASSERT_EQUAL_UINT32(steps, emitted);
+}
+
+void test_schedule_trapezoid() { bench_schedule("schedule_trapezoid", 0); }
+void test_schedule_scurve() { bench_schedule("schedule_scurve", 2000); }
+
+#if defined(ARDUINO)
+// Настоящий AccelStepper: run() выдаёт шаг, как только наступило время, поэтому
+// при очень высокой скорости число шагов в секунду и есть потолок опроса
+void test_accelstepper_run()
+{
+  AccelStepper stepper(AccelStepper::DRIVER, BENCH_STEP_PIN, BENCH_DIR_PIN);
+  stepper.setMaxSpeed(1000000);
+  stepper.setAcceleration(100 * STEPS_PER_MM);
+  stepper.moveTo(200000);
+
+  uint64_t start = now_us();
+  while (stepper.distanceToGo() != 0)
+    stepper.run();
+  report("accelstepper_run", 200000, now_us() - start);
+}
+#endif
+
+// Весь путь шага, кроме записи в GPIO: on_step() генератора - позиция, проверка
+// сравнения позиции (взведено, но не срабатывает) и интервал из таблицы.
+// Это потолок частоты прерывания шагов.
+#define BENCH_RUNS 5 // Повторов замера; в отчёт - самый быстрый, меньше шума планировщика
+
+static void no_compare(void *, int64_t) {}
+
+void test_step_path()
+{
+  static SimStepGenerator generator(BENCH_TIMER_HZ);
+  MotionLimits limits;
+  limits.max_speed = 20 * STEPS_PER_MM;
+  limits.acceleration = 100 * STEPS_PER_MM;
+  generator.set_limits(limits);
+
+  const int64_t steps = 200000;
+  uint64_t best_us = UINT64_MAX;
+  for (int run = 0; run < BENCH_RUNS; run++)
+  {
+    int64_t target = generator.current_position() + steps;
+    generator.set_position_compare(target + 1, no_compare, nullptr);
+    uint64_t start = now_us();
+    generator.move_to(target);
+    generator.advance_to(UINT64_MAX);
+    uint64_t elapsed_us = now_us() - start;
+    generator.clear_position_compare();
+    TEST_ASSERT_EQUAL_INT64(target, generator.current_position());
+    if (elapsed_us < best_us)
+      best_us = elapsed_us;
+  }
+  report("step_path", steps, best_us);
+}
+
+#define BENCH_CALLS 2000
+#define BENCH_RESPONSE_SIZE 1536 // Как response_buffer в main.cpp
+
+typedef MacroRail<DefaultRailConfig> BenchRail;
+
+// Запрос без сервера: параметры и заголовки - из таблиц пар имя-значение с
+// nullptr в конце, ответ только подсчитывается
+class BenchRequest : public HttpRequest
+{
+public:
+  using HttpRequest::send;
+
+  const char *const *args = nullptr;
+  const char *const *headers = nullptr;
+  int code = 0;
+  size_t sent = 0;
+
+  bool arg(const char *name, char *value, size_t size) override { return find(args, name, value, size); }
+  bool header(const char *name, char *value, size_t size) override { return find(headers, name, value, size); }
+  int body(char *, size_t) override { return -1; }
+  void send_header(const char *, const char *) override {}
+  void send(int status, const char *, const char *, size_t length) override
+  {
+    code = status;
+    sent += length;
+  }
+  void begin_stream(int status, const char *) override { code = status; }
+  bool send_chunk(const char *, size_t length) override
+  {
+    sent += length;
+    return true;
+  }
+  void end_stream() override {}
+
+private:
+  static bool find(const char *const *pairs, const char *name, char *value, size_t size)
+  {
+    for (; pairs && pairs[0]; pairs += 2)
+    {
+      if (strcmp(pairs[0], name) != 0)
+        continue;
+      if (strlen(pairs[1]) >= size)
+        return false;
+      strcpy(value, pairs[1]);
+      return true;
+    }
+    return false;
+  }
+};
+
+// Первый вызов - прогрев (статические данные, кеш), затем BENCH_RUNS серий по
+// BENCH_CALLS; в отчёт идёт самая быстрая серия и все выделения памяти
+template <typename Body>
+static void bench_calls(const char *name, Body body)
+{
+  body();
+  uint32_t allocations_before = allocations;
+  uint64_t best_ns = UINT64_MAX;
+  for (int run = 0; run < BENCH_RUNS; run++)
+  {
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < BENCH_CALLS; i++)
+      body();
+    uint64_t elapsed_ns = now_ns() - start;
+    if (elapsed_ns < best_ns)
+      best_ns = elapsed_ns;
+  }
+  report_calls(name, BENCH_CALLS, best_ns, (allocations - allocations_before) / BENCH_RUNS);
+}
+
+static bool render_status(const BenchRail::Status &status)
+{
+  static char buffer[BENCH_RESPONSE_SIZE];
+  BenchRequest request;
+  JsonWriter json(buffer, sizeof(buffer));
+  json.begin_object();
+  write_rail_status<BenchRail>(json, status, 100000);
+  json.end_object();
+  request.send(200, "application/json", json.c_str(), json.length());
+  return json.ok();
+}
+
+// Ответ /status без сетевых полей: покой и полная очередь заданий - самый длинный ответ
+void test_status_response()
+{
+  static BenchRail::Status status;
+  status = BenchRail::Status();
+  status.steps = 123456;
+  status.settings = BenchRail::Settings();
+  bench_calls("status_idle", [] { sink += render_status(status); });
+  TEST_ASSERT_TRUE(render_status(status));
+
+  status.state = BenchRail::SHOOTING;
+  status.job_stage = BenchRail::JOB_SHOOTING;
+  status.job_error = "Endstop triggered";
+  status.job_count = JOB_QUEUE_SIZE;
+  for (uint8_t i = 0; i < JOB_QUEUE_SIZE; i++)
+  {
+    BenchRail::JobRecord &job = status.jobs[i];
+    job.id = 1000 + i;
+    job.state = i < 4 ? BenchRail::JOB_ABORTED : i == 4 ? BenchRail::JOB_RUNNING : BenchRail::JOB_QUEUED;
+    job.frames = 400;
+    job.photos = 123;
+    job.queued_ms = 1000 * i;
+    job.started_ms = 2000 * i;
+    job.finished_ms = 3000 * i;
+    job.error = i < 4 ? "Endstop triggered" : nullptr;
+  }
+  bench_calls("status_full_queue", [] { sink += render_status(status); });
+  TEST_ASSERT_TRUE(render_status(status)); // Ответ помещается в буфер
+}
+
+// Интерфейс: полный ответ из flash и повторная загрузка по ETag
+void test_root_response()
+{
+  static const char *const no_headers[] = {nullptr};
+  static const char *const cached[] = {"If-None-Match", WEB_UI_ETAG, nullptr};
+  static BenchRequest request;
+
+  request.headers = no_headers;
+  bench_calls("root_200", [] { send_web_ui(request); });
+  TEST_ASSERT_EQUAL(200, request.code);
+
+  request.headers = cached;
+  bench_calls("root_304", [] { send_web_ui(request); });
+  TEST_ASSERT_EQUAL(304, request.code);
+}
+
+// Разбор параметров /start со всеми полями формы
+void test_start_parse()
+{
+  static const char *const args[] = {"photos", "150", "step", "0.05", "speed", "0.7",
+                                     "before", "100", "after", "200", "focus_time", "500",
+                                     "release_time", "200", "scurve", "1", "continuous", "0",
+                                     "return_to_start", "1", nullptr};
+  static BenchRequest request;
+  static BenchRail::Settings settings;
+  static bool return_to_start;
+  request.args = args;
+  bench_calls("start_parse", [] { parse_start_args(request, settings, return_to_start); });
+  TEST_ASSERT_EQUAL(150, settings.total_photos);
+  TEST_ASSERT_EQUAL(50, settings.step_size_um);
+  TEST_ASSERT_TRUE(return_to_start);
+}
+
+// Прогноз стека: считается в задаче движения при запуске задания и в обработчике /estimate
+void test_stack_estimate()
+{
+  static BenchRail::Simulator simulator;
+  static BenchRail::Settings settings;
+  static StackEstimate estimate;
+  settings = BenchRail::Settings();
+  settings.total_photos = 500;
+  settings.step_size_um = 50;
+  settings.focus_time = 400; // Опережение фокуса: расписание перебирается по периодам
+  static BenchRail::JobPlan plan;
+  const char *error;
+  TEST_ASSERT_TRUE(BenchRail::shooting_plan(settings, true, plan, error));
+  bench_calls("estimate_stepped", [] { estimate = simulator.estimate(plan, 7267); });
+  TEST_ASSERT_EQUAL_UINT32(500, estimate.frames);
+
+  settings.continuous = true;
+  TEST_ASSERT_TRUE(BenchRail::shooting_plan(settings, true, plan, error));
+  bench_calls("estimate_flyby", [] { estimate = simulator.estimate(plan, 7267); });
+  TEST_ASSERT_EQUAL_UINT32(500, estimate.frames);
+}
+
+#if !defined(ARDUINO)
+// Стоимость MacroRail::update() по состояниям на модели рельса (include/rail_sim.h).
+// Время рельса виртуальное; настоящими часами замеряется только update(), шаги
+// генератора между вызовами в замер не входят. На плате та же величина видна
+// в /metrics (rail_update_seconds).
+struct UpdateCost
+{
+  uint32_t calls;
+  uint64_t ns;
+  uint64_t max_ns;
+  uint32_t allocs;
+};
+
+typedef RailSim<DefaultRailConfig> BenchSim;
+
+static UpdateCost update_costs[BenchRail::ERROR + 1][2]; // Второй индекс - съёмка на ходу
+
+// max_ms периодов или, если until_idle, до покоя с пустой очередью
+static void measure_updates(BenchSim &sim, uint32_t max_ms, bool until_idle = true)
+{
+  for (uint32_t ms = 0; ms < max_ms; ms++)
+  {
+    BenchRail::State state = sim.rail.get_state();
+    bool flyby = state == BenchRail::SHOOTING && sim.rail.get_status().settings.continuous;
+    if (until_idle && ms > 0 && state == BenchRail::IDLE && sim.rail.get_status().job_stage == BenchRail::JOB_NONE)
+      return;
+    sim.advance();
+    uint32_t allocations_before = allocations;
+    uint64_t start = now_ns();
+    sim.rail.update();
+    uint64_t elapsed = now_ns() - start;
+    UpdateCost &cost = update_costs[state][flyby];
+    cost.calls++;
+    cost.ns += elapsed;
+    if (elapsed > cost.max_ns)
+      cost.max_ns = elapsed;
+    cost.allocs += allocations - allocations_before;
+  }
+}
+
+void test_update_by_state()
+{
+  sim_platform().reset();
+  sim_platform().log_enabled = false;
+  static BenchSim sim(20.0f);
+
+  measure_updates(sim, 2000, false); // Покой
+  sim.rail.start_homing();
+  measure_updates(sim, 60000);
+  TEST_ASSERT_TRUE(sim.rail.is_referenced());
+  sim.rail.move_to(30.0f);
+  measure_updates(sim, 60000);
+
+  BenchRail::Settings settings;
+  settings.step_size_um = 100;
+  settings.total_photos = 20;
+  TEST_ASSERT_TRUE(sim.rail.start_shooting(settings, false));
+  measure_updates(sim, 120000);
+  settings.continuous = true;
+  settings.step_size_um = 50;
+  settings.total_photos = 100;
+  TEST_ASSERT_TRUE(sim.rail.start_shooting(settings, true));
+  measure_updates(sim, 120000);
+  TEST_ASSERT_EQUAL(100, sim.rail.get_status().photo_count);
+
+  for (int state = 0; state <= BenchRail::ERROR; state++)
+    for (int flyby = 0; flyby < 2; flyby++)
+    {
+      const UpdateCost &cost = update_costs[state][flyby];
+      if (!cost.calls)
+        continue;
+      char name[40];
+      snprintf(name, sizeof(name), "update_%s%s", BenchRail::get_state_string((BenchRail::State)state),
+               flyby ? "_flyby" : "");
+      for (char *c = name; *c; c++)
+        *c = tolower(*c);
+      printf("BENCH {\"name\":\"%s\",\"calls\":%lu,\"ns_per_call\":%.0f,\"ns_max\":%llu,\"allocs_per_call\":%.2f}\n",
+             name, (unsigned long)cost.calls, (double)cost.ns / cost.calls, (unsigned long long)cost.max_ns,
+             (double)cost.allocs / cost.calls);
+      TEST_ASSERT_EQUAL_UINT32(0, cost.allocs); // Цикл движения не выделяет память
+    }
+}
+#endif
+
+static void run_benchmarks()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_schedule_trapezoid);
+  RUN_TEST(test_schedule_scurve);
+#if defined(ARDUINO)
+  RUN_TEST(test_accelstepper_run); // Сравнение с библиотекой - только на плате, где она настоящая
+#endif
+  RUN_TEST(test_step_path);
+  RUN_TEST(test_status_response);
+  RUN_TEST(test_root_response);
+  RUN_TEST(test_start_parse);
+  RUN_TEST(test_stack_estimate);
+#if !defined(ARDUINO)
+  RUN_TEST(test_update_by_state);
+#endif
+  UNITY_END();
+}
+
+#if defined(ARDUINO)
+void setup()
+{
+  delay(2000); // Время на подключение монитора порта
+  run_benchmarks();
+}
+
+void loop() {}
+#else
+int main()
+{
+  run_benchmarks();
+  return 0;
+}
+#endif
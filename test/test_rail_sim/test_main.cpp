@@ -0,0 +1,266 @@
+// Логика рельса на хосте: хоуминг, стек и съёмка на ходу против модели механики
+// на виртуальном времени. Минуты работы рельса проходят за миллисекунды.
+//   pio test -e native -f test_rail_sim
+
+#include <unity.h>
+
+#include "rail_sim.h"
+
+typedef RailSim<DefaultRailConfig> Sim;
+typedef Sim::Rail Rail;
+
+static const int64_t RETRACT_STEPS = Rail::um_to_steps(DefaultRailConfig::homing_retract_um);
+
+void setUp()
+{
+  sim_platform().reset();
+  sim_platform().log_enabled = false;
+}
+void tearDown() {}
+
+static void home(Sim &sim)
+{
+  sim.rail.start_homing();
+  TEST_ASSERT_TRUE(sim.run_until_idle(60000));
+  TEST_ASSERT_TRUE(sim.rail.is_referenced());
+}
+
+// Ноль - на отъезде от фронта концевика, независимо от начального положения
+void test_homing_sets_zero()
+{
+  Sim sim(20.0f);
+  home(sim);
+  TEST_ASSERT_EQUAL_INT64(0, sim.rail.get_current_steps());
+  TEST_ASSERT_INT64_WITHIN(2, RETRACT_STEPS, sim.carriage_steps());
+  TEST_ASSERT_FALSE(sim.endstop_pressed());
+}
+
+void test_homing_from_endstop()
+{
+  Sim sim(0.0f);
+  home(sim);
+  TEST_ASSERT_INT64_WITHIN(2, RETRACT_STEPS, sim.carriage_steps());
+}
+
+// Кадры стека с остановками - ровно через шаг
+void test_stepped_stack()
+{
+  Sim sim(5.0f);
+  home(sim);
+  Rail::Settings settings;
+  settings.step_size_um = 100;
+  settings.total_photos = 6;
+  TEST_ASSERT_TRUE(sim.rail.start_shooting(settings, false));
+  TEST_ASSERT_TRUE(sim.run_until_idle(60000));
+
+  TEST_ASSERT_EQUAL_UINT32(6, sim.frame_count());
+  for (uint32_t i = 0; i < sim.frame_count(); i++)
+    TEST_ASSERT_EQUAL_INT64(Rail::um_to_steps(100 * i), sim.frame_steps(i));
+  TEST_ASSERT_EQUAL(6, sim.rail.get_status().photo_count);
+}
+
+// На ходу затвор срабатывает по сравнению позиции: кадры там же, что и со стопами
+void test_flyby_stack()
+{
+  Sim sim(5.0f);
+  home(sim);
+  sim.rail.move_to(1.0f); // Место для разгона до первого кадра: у нуля он упирается в предел хода
+  TEST_ASSERT_TRUE(sim.run_until_idle(10000));
+  int64_t start = sim.rail.get_current_steps();
+
+  Rail::Settings settings;
+  settings.step_size_um = 50;
+  settings.total_photos = 20;
+  settings.continuous = true;
+  TEST_ASSERT_TRUE(sim.rail.start_shooting(settings, true));
+  TEST_ASSERT_TRUE(sim.run_until_idle(60000));
+
+  TEST_ASSERT_EQUAL_UINT32(20, sim.frame_count());
+  for (uint32_t i = 0; i < sim.frame_count(); i++)
+    TEST_ASSERT_EQUAL_INT64(start + Rail::um_to_steps(50 * i), sim.frame_steps(i));
+  TEST_ASSERT_EQUAL_INT64(start, sim.rail.get_current_steps()); // Вернулся к началу
+}
+
+// /start проходит те же проверки, что /job: стек без движения не запускается
+void test_start_rejects_bad_settings()
+{
+  Sim sim(5.0f);
+  home(sim);
+  Rail::Settings flyby;
+  flyby.continuous = true;
+  flyby.step_size_um = 0;
+  TEST_ASSERT_FALSE(sim.rail.start_shooting(flyby, false));
+  flyby.step_size_um = -50;
+  TEST_ASSERT_FALSE(sim.rail.start_shooting(flyby, false));
+
+  Rail::Settings stepped;
+  stepped.max_speed = 0;
+  TEST_ASSERT_FALSE(sim.rail.start_shooting(stepped, false));
+  stepped.max_speed = -1;
+  TEST_ASSERT_FALSE(sim.rail.start_shooting(stepped, false));
+  TEST_ASSERT_EQUAL(Rail::JOB_NONE, sim.rail.get_status().job_stage);
+  TEST_ASSERT_EQUAL(Rail::IDLE, sim.rail.get_state());
+}
+
+// План мимо plan_job(): проход с нулевой скоростью прерывается, а не завершается без кадров
+void test_flyby_zero_speed_aborts()
+{
+  Sim sim(5.0f);
+  home(sim);
+  Rail::JobPlan plan;
+  plan.settings.continuous = true;
+  plan.settings.step_size_um = 0;
+  plan.settings.total_photos = 5;
+  plan.segment_count = 1;
+  plan.segments[0].frames = 5;
+  plan.segments[0].speed = plan.settings.max_speed;
+  TEST_ASSERT_TRUE(sim.rail.start_job(plan));
+  TEST_ASSERT_TRUE(sim.run_until_idle(10000));
+  Rail::Status status = sim.rail.get_status();
+  TEST_ASSERT_TRUE(status.job_error != nullptr);
+  TEST_ASSERT_EQUAL(0, status.photo_count);
+  TEST_ASSERT_EQUAL(Rail::IDLE, status.state);
+}
+
+// Ручной ход посреди стека прерывает задание с причиной, а не завершает его
+void test_manual_move_aborts_stack()
+{
+  Sim sim(5.0f);
+  home(sim);
+  Rail::Settings settings;
+  settings.step_size_um = 100;
+  settings.total_photos = 10;
+  TEST_ASSERT_TRUE(sim.rail.start_shooting(settings, true));
+  TEST_ASSERT_TRUE(sim.run_until([&](Rail &) { return sim.frame_count() >= 2; }, 60000));
+  sim.rail.move_to(20.0f);
+  TEST_ASSERT_TRUE(sim.run_until_idle(60000));
+
+  Rail::Status status = sim.rail.get_status();
+  TEST_ASSERT_TRUE(status.job_error != nullptr);
+  TEST_ASSERT_TRUE(status.photo_count < 10);
+  TEST_ASSERT_EQUAL_INT64(Rail::mm_to_steps(20.0f), sim.rail.get_current_steps());
+  TEST_ASSERT_FALSE(sim_platform().level(DefaultRailConfig::focus_pin));
+  TEST_ASSERT_FALSE(sim_platform().level(DefaultRailConfig::shutter_pin));
+}
+
+// Ход посреди прохода: сравнение позиции снято, затвор и фокус отпущены
+void test_manual_move_aborts_flyby()
+{
+  Sim sim(5.0f);
+  home(sim);
+  sim.rail.move_to(1.0f);
+  TEST_ASSERT_TRUE(sim.run_until_idle(10000));
+  Rail::Settings settings;
+  settings.step_size_um = 50;
+  settings.total_photos = 20;
+  settings.continuous = true;
+  TEST_ASSERT_TRUE(sim.rail.start_shooting(settings, true));
+  TEST_ASSERT_TRUE(sim.run_until([&](Rail &) { return sim.frame_count() >= 2; }, 60000));
+  sim.rail.move_to(0.5f); // Назад через уже снятые кадры
+  TEST_ASSERT_TRUE(sim.run_until_idle(60000));
+  uint32_t frames = sim.frame_count();
+  sim.rail.move_to(3.0f); // Вперёд через ещё не снятые
+  TEST_ASSERT_TRUE(sim.run_until_idle(60000));
+
+  TEST_ASSERT_TRUE(sim.rail.get_status().job_error != nullptr);
+  TEST_ASSERT_EQUAL_UINT32(frames, sim.frame_count());
+  TEST_ASSERT_FALSE(sim_platform().level(DefaultRailConfig::focus_pin));
+  TEST_ASSERT_FALSE(sim_platform().level(DefaultRailConfig::shutter_pin));
+}
+
+static Rail::JobPlan shooting_plan(const Rail::Settings &settings, bool return_to_start)
+{
+  Rail::JobPlan plan;
+  const char *error = nullptr;
+  TEST_ASSERT_TRUE(Rail::shooting_plan(settings, return_to_start, plan, error));
+  return plan;
+}
+
+// Прогноз модели стека против прогона рельса: длительность, кадры, конечная позиция
+static StackSimulator<DefaultRailConfig> simulator;
+
+static void check_estimate(Sim &sim, const Rail::JobPlan &plan)
+{
+  StackEstimate estimate = simulator.estimate(plan, sim.rail.get_current_steps());
+  uint32_t started = sim.now_ms();
+  sim.clear_frames();
+  TEST_ASSERT_TRUE(sim.rail.start_job(plan));
+  sim.run_for_ms(estimate.total_ms / 2);
+  Rail::Status status = sim.rail.get_status();
+  TEST_ASSERT_EQUAL_UINT32(estimate.total_ms, status.job_estimate_ms);
+  TEST_ASSERT_INT64_WITHIN(2, estimate.total_ms - estimate.total_ms / 2, status.job_eta_ms);
+
+  TEST_ASSERT_TRUE(sim.run_until_idle(600000));
+  TEST_ASSERT_INT64_WITHIN(2, estimate.total_ms, sim.now_ms() - started);
+  TEST_ASSERT_EQUAL_UINT32(sim.frame_count(), estimate.frames);
+  TEST_ASSERT_EQUAL_INT64(sim.rail.get_current_steps(), estimate.final_steps);
+  TEST_ASSERT_EQUAL_UINT32(0, sim.rail.get_status().job_eta_ms);
+}
+
+void test_estimate_stepped()
+{
+  Sim sim(5.0f);
+  home(sim);
+  Rail::Settings settings;
+  settings.step_size_um = 100;
+  settings.total_photos = 10;
+  check_estimate(sim, shooting_plan(settings, false));
+
+  // Фокус на торможении и возврат к началу
+  settings.focus_time = 400;
+  settings.before_shoot_delay = 100;
+  check_estimate(sim, shooting_plan(settings, true));
+}
+
+// Задание из участков с подводом к началу и парковкой
+void test_estimate_job()
+{
+  Sim sim(5.0f);
+  home(sim);
+  JobSpec spec;
+  spec.has_start = true;
+  spec.start_um = 12000;
+  spec.segment_count = 2;
+  spec.segments[0] = {50, 20, 0.5f};
+  spec.segments[1] = {-200, 10, 2.0f};
+  spec.after = JOB_AFTER_PARK;
+  spec.park_um = 3000;
+  Rail::JobPlan plan;
+  const char *error = nullptr;
+  TEST_ASSERT_TRUE(Rail::plan_job(spec, plan, error));
+  check_estimate(sim, plan);
+}
+
+void test_estimate_flyby()
+{
+  Sim sim(5.0f);
+  home(sim);
+  Rail::Settings settings;
+  settings.step_size_um = 50;
+  settings.total_photos = 20;
+  settings.continuous = true;
+  check_estimate(sim, shooting_plan(settings, true));
+
+  // Затвор медленнее шага: кадры взводятся после прохода позиции
+  settings.step_size_um = 10;
+  settings.max_speed = 5;
+  settings.release_time = 200;
+  check_estimate(sim, shooting_plan(settings, false));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_homing_sets_zero);
+  RUN_TEST(test_homing_from_endstop);
+  RUN_TEST(test_stepped_stack);
+  RUN_TEST(test_flyby_stack);
+  RUN_TEST(test_start_rejects_bad_settings);
+  RUN_TEST(test_flyby_zero_speed_aborts);
+  RUN_TEST(test_manual_move_aborts_stack);
+  RUN_TEST(test_manual_move_aborts_flyby);
+  RUN_TEST(test_estimate_stepped);
+  RUN_TEST(test_estimate_job);
+  RUN_TEST(test_estimate_flyby);
+  return UNITY_END();
+}
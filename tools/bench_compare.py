@@ -0,0 +1,78 @@
+# Сравнение двух прогонов test/test_bench: строки BENCH из вывода pio test,
+# изменение каждой метрики и регрессии больше порога. Код выхода 1 - есть регрессии.
+#   pio test -e native -f test_bench -v > new.txt
+#   python tools/bench_compare.py old.txt new.txt [--threshold 10]
+
+import argparse
+import json
+import sys
+
+# Направление улучшения: +1 - больше лучше, -1 - меньше лучше, 0 - только показать
+# (единичный максимум слишком зависит от планировщика ОС)
+METRICS = {
+    "steps_per_s": +1,
+    "ns_per_call": -1,
+    "ns_max": 0,
+    "allocs_per_call": -1,
+}
+
+NS_FLOOR = 10  # Разница меньше - в пределах разрешения часов, не регрессия
+
+
+def load(path):
+    results = {}
+    with open(path, encoding="utf-8", errors="replace") as f:
+        for line in f:
+            start = line.find("BENCH {")
+            if start < 0:
+                continue
+            try:
+                record = json.loads(line[start + len("BENCH "):])
+            except ValueError:
+                continue
+            results[record["name"]] = record
+    return results
+
+
+def change(old, new):
+    if old == 0:
+        return 0.0 if new == 0 else float("inf")
+    return (new - old) * 100.0 / old
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two test_bench runs")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0, help="regression threshold, percent")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = 0
+    print("%-24s %-16s %14s %14s %9s" % ("benchmark", "metric", "baseline", "current", "change"))
+    for name in sorted(set(baseline) | set(current)):
+        if name not in baseline or name not in current:
+            print("%-24s %s" % (name, "only in current" if name in current else "only in baseline"))
+            continue
+        for metric, direction in METRICS.items():
+            if metric not in baseline[name] or metric not in current[name]:
+                continue
+            old = baseline[name][metric]
+            new = current[name][metric]
+            percent = change(old, new)
+            worse = direction != 0 and percent * direction < -args.threshold
+            if metric.startswith("ns_") and abs(new - old) < NS_FLOOR:
+                worse = False
+            # Выделения памяти сверяются точно: ноль в горячем пути должен оставаться нулём
+            if metric == "allocs_per_call":
+                worse = new > old
+            regressions += worse
+            print("%-24s %-16s %14.6g %14.6g %+8.1f%%%s" % (name, metric, old, new, percent, "  REGRESSION" if worse else ""))
+    if regressions:
+        print("%d regression(s) over %.0f%%" % (regressions, args.threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,73 @@
+# Сборка веб-интерфейса: web/index.html минифицируется, сжимается gzip и
+# записывается в include/web_ui.h массивом во flash вместе с ETag.
+# Запускается PlatformIO перед сборкой (extra_scripts) или вручную:
+#   python tools/build_web_ui.py
+
+import gzip
+import os
+import re
+import zlib
+
+try:
+    Import("env")  # noqa: F821 - определено в SCons
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE = os.path.join(PROJECT_DIR, "web", "index.html")
+OUTPUT = os.path.join(PROJECT_DIR, "include", "web_ui.h")
+
+
+def minify(html):
+    html = re.sub(r"<!--.*?-->", "", html, flags=re.S)
+    html = re.sub(r"/\*.*?\*/", "", html, flags=re.S)
+
+    # Однострочные комментарии только в <script>; "//" в URL внутри атрибутов не трогаем
+    def strip_js(match):
+        return re.sub(r"(^|\s)//[^\n]*", r"\1", match.group(0), flags=re.M)
+
+    html = re.sub(r"<script>.*?</script>", strip_js, html, flags=re.S)
+
+    # Переводы строк сохраняются: JS полагается на автоматическую вставку ";"
+    lines = (line.strip() for line in html.splitlines())
+    return "\n".join(line for line in lines if line)
+
+
+def main():
+    with open(SOURCE, encoding="utf-8") as f:
+        minified = minify(f.read()).encode("utf-8")
+    # mtime=0 - одинаковый вход даёт одинаковый архив и ETag
+    compressed = gzip.compress(minified, compresslevel=9, mtime=0)
+    etag = "%08x" % zlib.crc32(compressed)
+
+    rows = []
+    for i in range(0, len(compressed), 16):
+        rows.append("  " + ", ".join("0x%02x" % b for b in compressed[i:i + 16]) + ",")
+
+    header = "\n".join([
+        "#pragma once",
+        "",
+        "// Сгенерировано tools/build_web_ui.py из web/index.html, не редактировать.",
+        "// Исходник %d байт, после минификации %d, gzip %d." % (
+            os.path.getsize(SOURCE), len(minified), len(compressed)),
+        "",
+        "#include <stddef.h>",
+        "#include <stdint.h>",
+        "",
+        "// Константный массив на ESP32 и так остаётся во flash (.rodata), без PROGMEM",
+        "static const char WEB_UI_ETAG[] = \"\\\"%s\\\"\";" % etag,
+        "static const size_t WEB_UI_GZ_SIZE = %d;" % len(compressed),
+        "static const uint8_t WEB_UI_GZ[] = {",
+    ] + rows + ["};", ""])
+
+    # Перезапись только при изменении, чтобы не пересобирать main.cpp без нужды
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT, encoding="utf-8") as f:
+            if f.read() == header:
+                return
+    with open(OUTPUT, "w", encoding="utf-8") as f:
+        f.write(header)
+    print("Web UI: %d -> %d bytes gzip, ETag %s" % (len(minified), len(compressed), etag))
+
+
+main()
@@ -0,0 +1,198 @@
+# Разбор трассы шагов (сборка с -DSTEP_TRACE=1, см. include/step_trace.h):
+# гистограммы интервалов между шагами и отклонений от расписания, разбивка
+# отклонений по состоянию рельса и этапу съёмки, худшие шаги.
+#   curl "http://<ip>/trace?start=1"     # очистить и начать запись
+#   curl -o trace.bin "http://<ip>/trace"
+#   python tools/trace_decode.py trace.bin [--events] [--worst 20]
+# Вместо файла можно передать адрес: python tools/trace_decode.py http://<ip>/trace
+
+import argparse
+import math
+import struct
+import sys
+import urllib.request
+
+MAGIC = 0x43525452
+VERSION = 1
+HEADER = struct.Struct("<IBBHIIII")
+RECORD = struct.Struct("<IhBB")
+
+STEP, MOVE, STATE, SHOT_STAGE, FLYBY_STAGE, GAP = range(6)
+
+# Порядок - как в перечислениях MacroRailBase::State, ShotStage и FlybyStage
+STATES = ["IDLE", "HOMING", "HOMING_COMPLETE", "HOMING_RETRACT", "MOVING", "SHOOTING", "ERROR"]
+SHOT_STAGES = ["MOVING", "WAIT_FIRE", "EXPOSING"]
+FLYBY_STAGES = ["RUNUP", "FOCUS", "PASS"]
+
+ERROR_EDGES_US = [-50, -20, -10, -5, -2, -1, -0.5, 0.5, 1, 2, 5, 10, 20, 50]
+BAR_WIDTH = 50
+
+
+def name(names, value):
+    return names[value] if value < len(names) else str(value)
+
+
+def load(source):
+    if source.startswith("http://") or source.startswith("https://"):
+        with urllib.request.urlopen(source) as response:
+            return response.read()
+    if source == "-":
+        return sys.stdin.buffer.read()
+    with open(source, "rb") as f:
+        return f.read()
+
+
+def parse(data):
+    if len(data) < HEADER.size:
+        sys.exit("trace is shorter than its header")
+    magic, version, record_size, _, cpu_hz, timer_hz, count, lost = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+        sys.exit("not a step trace of version %d" % VERSION)
+    available = (len(data) - HEADER.size) // RECORD.size
+    if available < count:
+        print("warning: %d of %d records received" % (available, count), file=sys.stderr)
+        count = available
+    records = [RECORD.unpack_from(data, HEADER.size + i * RECORD.size) for i in range(count)]
+    return cpu_hz, timer_hz, lost, records
+
+
+def decode(cpu_hz, timer_hz, records):
+    """Шаги с временем, интервалом и отклонением в мкс плюс события по порядку."""
+    steps = []
+    events = []
+    time = 0
+    previous_cycles = None
+    interval_valid = False  # Есть ли предыдущий шаг или запуск движения без разрыва
+    state, shot_stage, flyby_stage = None, None, None
+    for cycles, error, kind, value in records:
+        if previous_cycles is not None:
+            time += (cycles - previous_cycles) & 0xFFFFFFFF
+        previous_cycles = cycles
+        time_us = time * 1e6 / cpu_hz
+        if kind == STEP:
+            if interval_valid:
+                if state == "SHOOTING":
+                    context = "SHOOTING/" + (flyby_stage if flyby_stage else shot_stage)
+                else:
+                    context = state or "?"
+                steps.append({
+                    "time_us": time_us,
+                    "interval_us": (time_us - last_time_us),
+                    "error_us": error * 1e6 / timer_hz,
+                    "saturated": error in (32767, -32768),
+                    "context": context,
+                })
+            interval_valid = True
+            last_time_us = time_us
+        elif kind == MOVE:
+            interval_valid = True
+            last_time_us = time_us
+            events.append((time_us, "move " + ("forward" if value else "back")))
+        elif kind == STATE:
+            state = name(STATES, value)
+            if state != "SHOOTING":
+                flyby_stage = None
+            events.append((time_us, "state " + state))
+        elif kind == SHOT_STAGE:
+            shot_stage = name(SHOT_STAGES, value)
+            flyby_stage = None
+            events.append((time_us, "shot stage " + shot_stage))
+        elif kind == FLYBY_STAGE:
+            flyby_stage = name(FLYBY_STAGES, value)
+            events.append((time_us, "fly-by stage " + flyby_stage))
+        elif kind == GAP:
+            interval_valid = False
+            events.append((time_us, "gap (download)"))
+    return steps, events
+
+
+def print_histogram(title, labels, counts):
+    print(title)
+    peak = max(counts) if counts and max(counts) else 1
+    width = max(len(label) for label in labels)
+    for label, count in zip(labels, counts):
+        bar = "#" * int(round(count * BAR_WIDTH / peak))
+        print("  %*s %8d %s" % (width, label, count, bar))
+    print()
+
+
+def interval_histogram(steps):
+    # Степени двойки в мкс: видно и разгон, и рабочую скорость
+    buckets = {}
+    for step in steps:
+        interval = max(step["interval_us"], 1e-3)
+        bucket = int(math.floor(math.log2(interval)))
+        buckets[bucket] = buckets.get(bucket, 0) + 1
+    keys = sorted(buckets)
+    labels = ["%g..%g us" % (2.0 ** k, 2.0 ** (k + 1)) for k in keys]
+    print_histogram("Step intervals", labels, [buckets[k] for k in keys])
+
+
+def error_histogram(steps):
+    counts = [0] * (len(ERROR_EDGES_US) + 1)
+    for step in steps:
+        index = 0
+        while index < len(ERROR_EDGES_US) and step["error_us"] >= ERROR_EDGES_US[index]:
+            index += 1
+        counts[index] += 1
+    labels = ["< %g us" % ERROR_EDGES_US[0]]
+    labels += ["%g..%g us" % (a, b) for a, b in zip(ERROR_EDGES_US, ERROR_EDGES_US[1:])]
+    labels += [">= %g us" % ERROR_EDGES_US[-1]]
+    print_histogram("Interval error (actual - scheduled)", labels, counts)
+
+
+def percentile(sorted_values, fraction):
+    index = min(len(sorted_values) - 1, int(fraction * len(sorted_values)))
+    return sorted_values[index]
+
+
+def context_table(steps):
+    groups = {}
+    for step in steps:
+        groups.setdefault(step["context"], []).append(step["error_us"])
+    print("%-24s %8s %9s %9s %9s" % ("context", "steps", "mean us", "p99 |us|", "max |us|"))
+    for context in sorted(groups):
+        errors = groups[context]
+        magnitudes = sorted(abs(e) for e in errors)
+        print("%-24s %8d %9.2f %9.2f %9.2f" % (context, len(errors), sum(errors) / len(errors),
+                                              percentile(magnitudes, 0.99), magnitudes[-1]))
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a step timing trace from /trace")
+    parser.add_argument("source", help="trace file, '-' for stdin, or the /trace URL")
+    parser.add_argument("--events", action="store_true", help="list moves, state and stage changes")
+    parser.add_argument("--worst", type=int, default=10, help="show the N steps with the largest error")
+    args = parser.parse_args()
+
+    cpu_hz, timer_hz, lost, records = parse(load(args.source))
+    steps, events = decode(cpu_hz, timer_hz, records)
+    print("%d records, %d overwritten; CPU %.0f MHz, schedule %g MHz" %
+          (len(records), lost, cpu_hz / 1e6, timer_hz / 1e6))
+    if not steps:
+        print("no measured steps")
+        return
+    saturated = sum(1 for step in steps if step["saturated"])
+    print("%d measured steps over %.1f ms%s\n" % (len(steps), (steps[-1]["time_us"] - steps[0]["time_us"]) / 1e3,
+                                                  ", %d errors saturated" % saturated if saturated else ""))
+
+    interval_histogram(steps)
+    error_histogram(steps)
+    context_table(steps)
+
+    if args.worst > 0:
+        print("Worst steps")
+        for step in sorted(steps, key=lambda s: abs(s["error_us"]), reverse=True)[:args.worst]:
+            print("  %12.1f us  interval %9.2f us  error %+8.2f us  %s" %
+                  (step["time_us"], step["interval_us"], step["error_us"], step["context"]))
+        print()
+
+    if args.events:
+        print("Events")
+        for time_us, text in events:
+            print("  %12.1f us  %s" % (time_us, text))
+
+
+if __name__ == "__main__":
+    main()